@@ -0,0 +1,212 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "expression_cache.hpp"
+#include "jit.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+struct BenchmarkResult {
+	std::string equation;
+	double exprtk_rate = 0.0;
+	double vm_rate = 0.0;
+	double jit_rate = 0.0;
+	double batch_rate = 0.0;
+	bool double_precision = false;
+};
+
+inline const std::vector<std::string>& readme_equations() {
+	static const std::vector<std::string> equations = {
+		"(x^2 + y^2)^0.5",
+		"sin(x^2 + y^2)",
+		"x^2 + y^2 >= 4",
+		"1/(x^2 + y^2)",
+		"1-abs(x+y)-abs(y-x)",
+		"sin(x) + cos(y)",
+	};
+	return equations;
+}
+
+// Samples per second for each evaluation backend over a side x side grid on [-25, 25]^2. The JIT and
+// SIMD kernels are float only, so double batches run through the scalar VM.
+template <typename T>
+inline bool measure_backends(ExpressionCache<T>& cache, const std::string& text, size_t side, BenchmarkResult& result) {
+	typedef std::chrono::steady_clock clock;
+
+	std::vector<T> axis(side);
+	for (size_t i = 0; i < side; i++)
+		axis[i] = T(-25) + T(50) * T(i) / T(side - 1);
+
+	const double samples = static_cast<double>(side * side);
+	auto rate = [&](clock::time_point start) {
+		return samples / std::chrono::duration<double>(clock::now() - start).count();
+	};
+
+	result.equation = text;
+	result.double_precision = std::is_same<T, double>::value;
+
+	std::shared_ptr<CompiledExpression<T>> compiled = cache.get(text, { "x", "y", "z" });
+	if (!compiled->valid)
+		return false;
+
+	volatile T sink = T(0);
+	clock::time_point start = clock::now();
+	for (T x : axis) {
+		for (T y : axis) {
+			compiled->variable(0) = x;
+			compiled->variable(1) = y;
+			sink = sink + compiled->value();
+		}
+	}
+	result.exprtk_rate = rate(start);
+
+	if (!compiled->program)
+		return true;
+
+	const Program& program = *compiled->program;
+	std::vector<T> registers;
+	load_constants(program, registers);
+
+	start = clock::now();
+	for (T x : axis) {
+		for (T y : axis) {
+			registers[0] = x;
+			registers[1] = y;
+			sink = sink + run_program(program, registers.data());
+		}
+	}
+	result.vm_rate = rate(start);
+
+	if constexpr (std::is_same<T, float>::value) {
+		std::unique_ptr<JitFunction> jit = JitFunction::compile(program);
+		if (jit) {
+			start = clock::now();
+			for (float x : axis) {
+				for (float y : axis) {
+					registers[0] = x;
+					registers[1] = y;
+					sink = sink + (*jit)(registers.data());
+				}
+			}
+			result.jit_rate = rate(start);
+		}
+	}
+
+	std::vector<T> column_x(side);
+	std::vector<T> column_z(side, T(0));
+	std::vector<T> out(side);
+	const T* inputs[] = { column_x.data(), axis.data(), column_z.data() };
+	start = clock::now();
+	for (T x : axis) {
+		std::fill(column_x.begin(), column_x.end(), x);
+		evaluate_batch(program, inputs, out.data(), side);
+		sink = sink + out[0];
+	}
+	result.batch_rate = rate(start);
+	return true;
+}
+
+// One row per equation and precision, float first.
+inline std::vector<BenchmarkResult> run_backend_benchmark(ExpressionCache<float>& single_cache, ExpressionCache<double>& double_cache, size_t side = 512) {
+	std::vector<BenchmarkResult> results;
+	for (const auto& text : readme_equations()) {
+		BenchmarkResult result;
+		if (measure_backends(single_cache, text, side, result))
+			results.push_back(result);
+
+		result = BenchmarkResult();
+		if (measure_backends(double_cache, text, side, result))
+			results.push_back(result);
+	}
+	return results;
+}
+
+struct MathBenchmarkResult {
+	std::string function;
+	MathAccuracy accuracy = MathAccuracy::Exact;
+	double rate = 0.0;
+	// largest distance from double precision libm, in units in the last place of the float result
+	double max_ulp = 0.0;
+};
+
+// Error of a float result in units in the last place of the exact value rounded to float. Values that
+// are not finite have to match exactly.
+inline double ulp_error(float actual, double expected) {
+	const float rounded = static_cast<float>(expected);
+	if (!std::isfinite(rounded) || !std::isfinite(actual)) {
+		if (std::isnan(rounded) && std::isnan(actual))
+			return 0.0;
+		return rounded == actual ? 0.0 : std::numeric_limits<double>::infinity();
+	}
+	const float magnitude = std::abs(rounded);
+	const double ulp = std::nextafter(magnitude, std::numeric_limits<float>::infinity()) - magnitude;
+	return std::abs(actual - expected) / ulp;
+}
+
+// Samples per second and largest error of sin, cos, exp, log and pow in each accuracy tier, over
+// count arguments spread across the range they are accurate in. The approximate tier flushes subnormal
+// results to zero, so exp and log are measured on normal numbers. sin(x*1000) reaches arguments the
+// close tier hands to libm, which only the approximate tier is allowed to get wrong.
+inline std::vector<MathBenchmarkResult> run_math_benchmark(size_t count = size_t(1) << 20) {
+	typedef std::chrono::steady_clock clock;
+
+	struct Function {
+		const char* text;
+		double (*reference)(double, double);
+		// x is drawn from [x_min, x_max], logarithmically when x_log is set, and y from [y_min, y_max]
+		double x_min, x_max;
+		bool x_log;
+		double y_min, y_max;
+	};
+	static const Function functions[] = {
+		{ "sin(x)", [](double x, double) { return std::sin(x); }, -100.0, 100.0, false, 0.0, 0.0 },
+		{ "cos(x)", [](double x, double) { return std::cos(x); }, -100.0, 100.0, false, 0.0, 0.0 },
+		// a computed argument past the reduction limit, which may share its register with the result
+		{ "sin(x*1000)", [](double x, double) { return std::sin(static_cast<double>(static_cast<float>(x * 1000.0))); }, -100.0, 100.0, false, 0.0, 0.0 },
+		{ "exp(x)", [](double x, double) { return std::exp(x); }, -87.0, 88.0, false, 0.0, 0.0 },
+		{ "log(x)", [](double x, double) { return std::log(x); }, 1e-37, 1e38, true, 0.0, 0.0 },
+		{ "pow(x, y)", [](double x, double y) { return std::pow(x, y); }, 1e-2, 1e2, true, -8.0, 8.0 },
+	};
+
+	std::mt19937 random(1234);
+	std::vector<float> xs(count), ys(count), zs(count, 0.0f), out(count);
+	std::vector<MathBenchmarkResult> results;
+	for (const Function& function : functions) {
+		std::uniform_real_distribution<double> x_draw(function.x_log ? std::log(function.x_min) : function.x_min, function.x_log ? std::log(function.x_max) : function.x_max);
+		std::uniform_real_distribution<double> y_draw(function.y_min, function.y_max);
+		for (size_t i = 0; i < count; i++) {
+			xs[i] = static_cast<float>(function.x_log ? std::exp(x_draw(random)) : x_draw(random));
+			ys[i] = static_cast<float>(y_draw(random));
+		}
+
+		ExprTree tree;
+		Program program;
+		ExpressionParser parser;
+		if (!parser.parse(function.text, { "x", "y", "z" }, tree) || !compile_program(tree, program))
+			continue;
+
+		const float* inputs[] = { xs.data(), ys.data(), zs.data() };
+		for (MathAccuracy accuracy : { MathAccuracy::Approximate, MathAccuracy::Close, MathAccuracy::Exact }) {
+			MathBenchmarkResult result;
+			result.function = function.text;
+			result.accuracy = accuracy;
+
+			const clock::time_point start = clock::now();
+			evaluate_batch(program, inputs, out.data(), count, accuracy);
+			result.rate = count / std::chrono::duration<double>(clock::now() - start).count();
+
+			for (size_t i = 0; i < count; i++)
+				result.max_ulp = std::max(result.max_ulp, ulp_error(out[i], function.reference(xs[i], ys[i])));
+			results.push_back(result);
+		}
+	}
+	return results;
+}
+
+#endif // !BENCHMARK_H
@@ -0,0 +1,281 @@
+#ifndef DERIVATIVE_H
+#define DERIVATIVE_H
+
+#include "expression_tree.hpp"
+#include "simplify.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Builds the derivative of an ExprTree along one of its variables. Derivatives that are zero
+// everywhere are tracked as -1 instead of a node, so products and sums with them never get built
+// and the result needs no 0 * x folding, which would be wrong for infinite x. Comparisons, rounding
+// and the other piecewise constant operations have a zero derivative wherever they have one at all.
+class SymbolicDifferentiator {
+public:
+	// Returns the simplified derivative of tree along variable, over the same variables.
+	ExprTree differentiate(const ExprTree& tree, int variable) {
+		out = tree;
+		wrt = variable;
+		derivatives.assign(tree.nodes.size(), -2);
+
+		int root = derive(tree.root);
+		if (root < 0)
+			root = out.constant(0.0);
+		out.root = root;
+		return simplifier.simplify(out);
+	}
+
+private:
+	ExprTree out;
+	int wrt = 0;
+	// derivative node of each source node; -1 when it is zero, -2 before it is built
+	std::vector<int> derivatives;
+	ExpressionSimplifier simplifier;
+
+	int constant(double value) {
+		return out.constant(value);
+	}
+
+	int add(int a, int b) {
+		if (a < 0) return b;
+		if (b < 0) return a;
+		return out.binary(Op::Add, a, b);
+	}
+
+	int sub(int a, int b) {
+		if (b < 0) return a;
+		if (a < 0) return out.unary(Op::Neg, b);
+		return out.binary(Op::Sub, a, b);
+	}
+
+	int mul(int a, int b) {
+		if (a < 0 || b < 0) return -1;
+		return out.binary(Op::Mul, a, b);
+	}
+
+	int div(int a, int b) {
+		if (a < 0) return -1;
+		return out.binary(Op::Div, a, b);
+	}
+
+	int neg(int a) {
+		if (a < 0) return -1;
+		return out.unary(Op::Neg, a);
+	}
+
+	// A zero derivative as a node, for the branches of a select.
+	int node_or_zero(int a) {
+		return a < 0 ? constant(0.0) : a;
+	}
+
+	int derive(int node) {
+		if (derivatives[node] != -2)
+			return derivatives[node];
+
+		// source nodes keep their indices in out, but out may grow while n is in use
+		const ExprNode n = out.nodes[node];
+		const int arity = op_arity(n.op);
+		const int a = arity > 0 ? n.args[0] : -1;
+		const int b = arity > 1 ? n.args[1] : -1;
+		const int c = arity > 2 ? n.args[2] : -1;
+		const int da = arity > 0 ? derive(a) : -1;
+		const int db = arity > 1 ? derive(b) : -1;
+		const int dc = arity > 2 ? derive(c) : -1;
+
+		int result = -1;
+		switch (n.op) {
+		case Op::Const:
+			break;
+		case Op::Var:
+			if (n.variable == wrt)
+				result = constant(1.0);
+			break;
+		case Op::Neg: result = neg(da); break;
+		case Op::Add: result = add(da, db); break;
+		case Op::Sub: result = sub(da, db); break;
+		case Op::Mul: result = add(mul(da, b), mul(a, db)); break;
+		case Op::Div:
+			if (db < 0)
+				result = div(da, b);
+			else
+				result = div(sub(mul(da, b), mul(a, db)), mul(b, b));
+			break;
+		case Op::Mod:
+			// a - b * trunc(a / b), with the truncation constant between its jumps
+			result = sub(da, mul(db, out.unary(Op::Trunc, out.binary(Op::Div, a, b))));
+			break;
+		case Op::Pow:
+			if (da < 0 && db < 0)
+				break;
+			if (db < 0)
+				result = mul(mul(b, out.binary(Op::Pow, a, out.binary(Op::Sub, b, constant(1.0)))), da);
+			else if (da < 0)
+				result = mul(mul(node, out.unary(Op::Log, a)), db);
+			else
+				result = mul(node, add(mul(db, out.unary(Op::Log, a)), div(mul(b, da), a)));
+			break;
+		case Op::Select:
+			if (db >= 0 || dc >= 0)
+				result = out.ternary(Op::Select, a, node_or_zero(db), node_or_zero(dc));
+			break;
+		case Op::Min:
+			if (da >= 0 || db >= 0)
+				result = out.ternary(Op::Select, out.binary(Op::Lt, b, a), node_or_zero(db), node_or_zero(da));
+			break;
+		case Op::Max:
+			if (da >= 0 || db >= 0)
+				result = out.ternary(Op::Select, out.binary(Op::Lt, a, b), node_or_zero(db), node_or_zero(da));
+			break;
+		case Op::Atan2:
+			if (da >= 0 || db >= 0)
+				result = div(sub(mul(b, da), mul(a, db)), out.binary(Op::Add, out.binary(Op::Mul, a, a), out.binary(Op::Mul, b, b)));
+			break;
+		case Op::Hypot:
+			if (da >= 0 || db >= 0)
+				result = div(add(mul(a, da), mul(b, db)), node);
+			break;
+		case Op::Abs: result = mul(out.unary(Op::Sgn, a), da); break;
+		case Op::Sqrt: result = div(da, out.binary(Op::Mul, constant(2.0), node)); break;
+		case Op::Exp: result = mul(node, da); break;
+		case Op::Log: result = div(da, a); break;
+		case Op::Log10: result = div(da, out.binary(Op::Mul, a, constant(2.30258509299404568402))); break;
+		case Op::Log2: result = div(da, out.binary(Op::Mul, a, constant(0.69314718055994530942))); break;
+		case Op::Sin: result = mul(out.unary(Op::Cos, a), da); break;
+		case Op::Cos: result = neg(mul(out.unary(Op::Sin, a), da)); break;
+		case Op::Tan: result = mul(out.binary(Op::Add, constant(1.0), out.binary(Op::Mul, node, node)), da); break;
+		case Op::Asin: result = div(da, out.unary(Op::Sqrt, out.binary(Op::Sub, constant(1.0), out.binary(Op::Mul, a, a)))); break;
+		case Op::Acos: result = neg(div(da, out.unary(Op::Sqrt, out.binary(Op::Sub, constant(1.0), out.binary(Op::Mul, a, a))))); break;
+		case Op::Atan: result = div(da, out.binary(Op::Add, constant(1.0), out.binary(Op::Mul, a, a))); break;
+		case Op::Sinh: result = mul(out.unary(Op::Cosh, a), da); break;
+		case Op::Cosh: result = mul(out.unary(Op::Sinh, a), da); break;
+		case Op::Tanh: result = mul(out.binary(Op::Sub, constant(1.0), out.binary(Op::Mul, node, node)), da); break;
+		default:
+			break;
+		}
+
+		derivatives[node] = result;
+		return result;
+	}
+};
+
+// Writes a tree back as text exprtk and ExpressionParser both read, with only the brackets that
+// precedence requires. Shared subtrees are written out at every use.
+class ExpressionPrinter {
+public:
+	std::string print(const ExprTree& tree) {
+		source = &tree;
+		int precedence;
+		return print(tree.root, precedence);
+	}
+
+private:
+	const ExprTree* source = nullptr;
+
+	// higher binds tighter; primary covers numbers, variables, calls and bracketed text
+	enum Precedence { Or, And, Comparison, Sum, Product, Power, Primary };
+
+	static std::string number(double value) {
+		if (std::isnan(value))
+			return "(0 / 0)";
+		if (std::isinf(value))
+			return value > 0 ? "(1 / 0)" : "(-1 / 0)";
+		char text[32];
+		std::snprintf(text, sizeof(text), "%.15g", value);
+		if (std::strtod(text, nullptr) != value)
+			std::snprintf(text, sizeof(text), "%.17g", value);
+		return text;
+	}
+
+	std::string operand(int node, int required) {
+		int precedence;
+		const std::string text = print(node, precedence);
+		return precedence < required ? "(" + text + ")" : text;
+	}
+
+	std::string call(const char* name, const ExprNode& n) {
+		std::string text = std::string(name) + "(";
+		for (int i = 0; i < op_arity(n.op); i++) {
+			int precedence;
+			text += (i > 0 ? ", " : "") + print(n.args[i], precedence);
+		}
+		return text + ")";
+	}
+
+	std::string print(int node, int& precedence) {
+		const ExprNode& n = source->nodes[node];
+		precedence = Primary;
+
+		const char* infix = nullptr;
+		int level = Primary;
+		switch (n.op) {
+		// negations read like a subtraction from zero, so they are bracketed wherever one would be
+		case Op::Const: {
+			const std::string text = number(n.value);
+			if (text[0] == '-')
+				precedence = Sum;
+			return text;
+		}
+		case Op::Var: return source->variables[n.variable];
+		case Op::Neg:
+			precedence = Sum;
+			return "-" + operand(n.args[0], Primary);
+		case Op::Not: return call("not", n);
+		case Op::Select: return call("if", n);
+		case Op::Min: return call("min", n);
+		case Op::Max: return call("max", n);
+		case Op::Atan2: return call("atan2", n);
+		case Op::Hypot: return call("hypot", n);
+		case Op::Abs: return call("abs", n);
+		case Op::Sqrt: return call("sqrt", n);
+		case Op::Exp: return call("exp", n);
+		case Op::Log: return call("log", n);
+		case Op::Log10: return call("log10", n);
+		case Op::Log2: return call("log2", n);
+		case Op::Sin: return call("sin", n);
+		case Op::Cos: return call("cos", n);
+		case Op::Tan: return call("tan", n);
+		case Op::Asin: return call("asin", n);
+		case Op::Acos: return call("acos", n);
+		case Op::Atan: return call("atan", n);
+		case Op::Sinh: return call("sinh", n);
+		case Op::Cosh: return call("cosh", n);
+		case Op::Tanh: return call("tanh", n);
+		case Op::Floor: return call("floor", n);
+		case Op::Ceil: return call("ceil", n);
+		case Op::Round: return call("round", n);
+		case Op::Trunc: return call("trunc", n);
+		case Op::Sgn: return call("sgn", n);
+		case Op::Or: infix = " or "; level = Or; break;
+		case Op::And: infix = " and "; level = And; break;
+		case Op::Lt: infix = " < "; level = Comparison; break;
+		case Op::Le: infix = " <= "; level = Comparison; break;
+		case Op::Gt: infix = " > "; level = Comparison; break;
+		case Op::Ge: infix = " >= "; level = Comparison; break;
+		case Op::Eq: infix = " == "; level = Comparison; break;
+		case Op::Ne: infix = " != "; level = Comparison; break;
+		case Op::Add: infix = " + "; level = Sum; break;
+		case Op::Sub: infix = " - "; level = Sum; break;
+		case Op::Mul: infix = " * "; level = Product; break;
+		case Op::Div: infix = " / "; level = Product; break;
+		case Op::Mod: infix = " % "; level = Product; break;
+		case Op::Pow:
+			// the base of a power is always a primary, and powers group to the right
+			precedence = Power;
+			return operand(n.args[0], Primary) + "^" + operand(n.args[1], Power);
+		default:
+			return "nan";
+		}
+
+		// operators group to the left, so only the right operand needs brackets at the same level,
+		// and comparisons are never chained
+		precedence = level;
+		const int left = level == Comparison ? level + 1 : level;
+		return operand(n.args[0], left) + infix + operand(n.args[1], level + 1);
+	}
+};
+
+#endif // !DERIVATIVE_H
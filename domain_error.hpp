@@ -0,0 +1,87 @@
+#ifndef DOMAIN_ERROR_H
+#define DOMAIN_ERROR_H
+
+#include "program.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Why a sample came out NaN or infinite. Evaluation never throws; the reason is recovered afterwards
+// by replaying the sample with diagnose().
+enum class DomainError : uint8_t {
+	None,
+	LogOfNonPositive,
+	DivideByZero,
+	SqrtOfNegative,
+	InverseTrigOutOfRange,
+	NegativeBasePower,
+	Overflow,
+	Unknown,
+	Count
+};
+
+inline const char* domain_error_name(DomainError error) {
+	switch (error) {
+	case DomainError::LogOfNonPositive: return "log of zero or a negative number";
+	case DomainError::DivideByZero: return "division by zero";
+	case DomainError::SqrtOfNegative: return "square root of a negative number";
+	case DomainError::InverseTrigOutOfRange: return "asin/acos outside [-1, 1]";
+	case DomainError::NegativeBasePower: return "fractional power of a negative number";
+	case DomainError::Overflow: return "overflow";
+	case DomainError::Unknown: return "undefined";
+	default: return "none";
+	}
+}
+
+template <typename T>
+inline DomainError classify(const Instruction& ins, T a, T b) {
+	switch (ins.op) {
+	case Op::Log:
+	case Op::Log10:
+	case Op::Log2:
+		return a <= T(0) ? DomainError::LogOfNonPositive : DomainError::Overflow;
+	case Op::Div:
+	case Op::Mod:
+		return b == T(0) ? DomainError::DivideByZero : DomainError::Overflow;
+	case Op::Sqrt:
+		return a < T(0) ? DomainError::SqrtOfNegative : DomainError::Overflow;
+	case Op::Asin:
+	case Op::Acos:
+		return DomainError::InverseTrigOutOfRange;
+	case Op::Pow:
+		if (a < T(0))
+			return DomainError::NegativeBasePower;
+		return a == T(0) && b < T(0) ? DomainError::DivideByZero : DomainError::Overflow;
+	default:
+		return DomainError::Overflow;
+	}
+}
+
+// Replays one sample and reports the first instruction that turned finite operands into a
+// non-finite result. inputs holds one value per program input.
+template <typename T>
+inline DomainError diagnose(const Program& program, const T* inputs) {
+	thread_local std::vector<T> registers;
+	registers.assign(program.register_count, T(0));
+	for (size_t i = 0; i < program.inputs.size(); i++)
+		registers[i] = inputs[i];
+	for (size_t i = 0; i < program.constants.size(); i++)
+		registers[program.first_constant() + i] = static_cast<T>(program.constants[i]);
+
+	for (const Instruction& ins : program.code) {
+		const T a = registers[ins.a];
+		const T b = registers[ins.b];
+		const T c = registers[ins.c];
+		const T result = apply_op<T>(ins.op, a, b, c);
+		registers[ins.dst] = result;
+
+		const int arity = op_arity(ins.op);
+		const bool finite_operands = std::isfinite(a) && (arity < 2 || std::isfinite(b)) && (arity < 3 || std::isfinite(c));
+		if (finite_operands && !std::isfinite(result))
+			return classify(ins, a, b);
+	}
+	return std::isfinite(registers[program.result]) ? DomainError::None : DomainError::Unknown;
+}
+
+#endif // !DOMAIN_ERROR_H
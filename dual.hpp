@@ -0,0 +1,113 @@
+#ifndef DUAL_H
+#define DUAL_H
+
+#include "program.hpp"
+
+#include <cmath>
+#include <vector>
+
+// A value with its partial derivatives along x and y, carried through a Program in one pass.
+template <typename T>
+struct Dual {
+	T value = T(0);
+	T dx = T(0);
+	T dy = T(0);
+};
+
+template <typename T>
+inline Dual<T> make_dual(T value, T dx, T dy) {
+	Dual<T> d;
+	d.value = value;
+	d.dx = dx;
+	d.dy = dy;
+	return d;
+}
+
+// value with the derivative of a scaled by slope
+template <typename T>
+inline Dual<T> chain(T value, const Dual<T>& a, T slope) {
+	return make_dual(value, a.dx * slope, a.dy * slope);
+}
+
+// Forward-mode derivative rules. Piecewise-constant operations (comparisons, logic, rounding) have
+// zero derivative; min, max and select follow the operand they pick.
+template <typename T>
+inline Dual<T> apply_dual(Op op, const Dual<T>& a, const Dual<T>& b, const Dual<T>& c) {
+	const T value = apply_op<T>(op, a.value, b.value, c.value);
+	const T zero = T(0);
+	const T one = T(1);
+	const T two = T(2);
+
+	switch (op) {
+	case Op::Neg: return make_dual(value, -a.dx, -a.dy);
+	case Op::Add: return make_dual(value, a.dx + b.dx, a.dy + b.dy);
+	case Op::Sub: return make_dual(value, a.dx - b.dx, a.dy - b.dy);
+	case Op::Mul: return make_dual(value, a.dx * b.value + a.value * b.dx, a.dy * b.value + a.value * b.dy);
+	case Op::Div: {
+		const T denominator = b.value * b.value;
+		return make_dual(value, (a.dx * b.value - a.value * b.dx) / denominator, (a.dy * b.value - a.value * b.dy) / denominator);
+	}
+	case Op::Mod: {
+		const T quotient = std::trunc(a.value / b.value);
+		return make_dual(value, a.dx - quotient * b.dx, a.dy - quotient * b.dy);
+	}
+	case Op::Pow: {
+		const T base_slope = b.value * std::pow(a.value, b.value - one);
+		Dual<T> result = chain(value, a, base_slope);
+		if (b.dx != zero || b.dy != zero) {
+			const T exponent_slope = value * std::log(a.value);
+			result.dx += b.dx * exponent_slope;
+			result.dy += b.dy * exponent_slope;
+		}
+		return result;
+	}
+	case Op::Select: return a.value != zero ? b : c;
+	case Op::Min: return b.value < a.value ? b : a;
+	case Op::Max: return a.value < b.value ? b : a;
+	case Op::Atan2: {
+		const T denominator = a.value * a.value + b.value * b.value;
+		return make_dual(value, (b.value * a.dx - a.value * b.dx) / denominator, (b.value * a.dy - a.value * b.dy) / denominator);
+	}
+	case Op::Hypot: return make_dual(value, (a.value * a.dx + b.value * b.dx) / value, (a.value * a.dy + b.value * b.dy) / value);
+	case Op::Abs: return chain(value, a, a.value < zero ? -one : one);
+	case Op::Sqrt: return chain(value, a, T(0.5) / value);
+	case Op::Exp: return chain(value, a, value);
+	case Op::Log: return chain(value, a, one / a.value);
+	case Op::Log10: return chain(value, a, one / (a.value * T(2.30258509299404568402)));
+	case Op::Log2: return chain(value, a, one / (a.value * T(0.69314718055994530942)));
+	case Op::Sin: return chain(value, a, std::cos(a.value));
+	case Op::Cos: return chain(value, a, -std::sin(a.value));
+	case Op::Tan: return chain(value, a, one + value * value);
+	case Op::Asin: return chain(value, a, one / std::sqrt(one - a.value * a.value));
+	case Op::Acos: return chain(value, a, -one / std::sqrt(one - a.value * a.value));
+	case Op::Atan: return chain(value, a, one / (one + a.value * a.value));
+	case Op::Sinh: return chain(value, a, std::cosh(a.value));
+	case Op::Cosh: return chain(value, a, std::sinh(a.value));
+	case Op::Tanh: return chain(value, a, one - value * value);
+	case Op::MulAdd:
+		return make_dual(value, a.dx * b.value + a.value * b.dx + c.dx, a.dy * b.value + a.value * b.dy + c.dy);
+	case Op::Square: return chain(value, a, two * a.value);
+	case Op::SumSquares:
+		return make_dual(value, two * (a.value * a.dx + b.value * b.dx), two * (a.value * a.dy + b.value * b.dy));
+	default: return make_dual(value, zero, zero);
+	}
+}
+
+// Same contract as run_program, on dual registers. Inputs 0 and 1 are seeded as x and y by the caller.
+template <typename T>
+inline Dual<T> run_dual_program(const Program& program, Dual<T>* registers) {
+	for (const Instruction& ins : program.code) {
+		registers[ins.dst] = apply_dual(ins.op, registers[ins.a], registers[ins.b], registers[ins.c]);
+	}
+	return registers[program.result];
+}
+
+template <typename T>
+inline void load_dual_constants(const Program& program, std::vector<Dual<T>>& registers) {
+	registers.assign(program.register_count, Dual<T>());
+	for (size_t i = 0; i < program.constants.size(); i++) {
+		registers[program.first_constant() + i].value = static_cast<T>(program.constants[i]);
+	}
+}
+
+#endif // !DUAL_H
@@ -3,21 +3,47 @@
 #include "imgui_impl_opengl3.h"
 #include "imgui_internal.h"
 
+#include <limits>
 #include <vector>
 #include <string>
 
 #include <glm/glm.hpp>
 
+#include "domain_error.hpp"
+#include "glsl.hpp"
+#include "grid_cache.hpp"
+#include "parameters.hpp"
+#include "simd_eval.hpp"
+#include "sweep.hpp"
+
+struct PreviewSlot;
+
 struct Equation {
+	// other equations refer to this one by name; empty when none can
+	char name[32] = "";
 	char buf[256] = "";
+	// buf with the equations it refers to expanded, which is what is compiled
+	std::string source;
+	// why the references in buf could not be resolved
+	std::string reference_error;
+	// filled in the background while the text is edited
+	std::shared_ptr<PreviewSlot> preview;
+	std::string compile_error;
+	// why the last Differentiate built no equations
+	std::string derivative_error;
+	// the vertices are a coarse preview of the text rather than a full generation
+	bool is_preview = false;
+	// counts generations and changes of settings; previews requested before the latest are dropped
+	unsigned int generation = 0;
 	float data[3] = { 1.0, 0.5, 0.2 };
 	int sample_size = 1000;
 	float min_x = -25.0;
 	float max_x = 25.0;
 	float min_y = -25.0;
 	float max_y = 25.0;
-	float min_z = -25.0;
-	float max_z = 25.0;
+	// samples outside are not drawn; unbounded until the user sets a range
+	float min_z = -std::numeric_limits<float>::infinity();
+	float max_z = std::numeric_limits<float>::infinity();
 	std::vector<glm::vec3> points_vec_equation;
 	bool is_3d = true;
 	bool is_visible = true;
@@ -25,6 +51,32 @@ struct Equation {
 	bool is_mesh = false;
 	std::vector<unsigned int> indices;
 	float discontinuity_threshold = 10.0f;
+	bool double_precision = false;
+	// how the vector kernels compute sin, cos, exp, log and pow; double precision always uses libm
+	MathAccuracy accuracy = MathAccuracy::Exact;
+	size_t parsed_operations = 0;
+	size_t simplified_operations = 0;
+	size_t clipped_samples = 0;
+	size_t domain_errors[static_cast<size_t>(DomainError::Count)] = {};
+	// library symbols the equation was last generated against
+	std::string library_key;
+	std::vector<Parameter> parameters;
+	// kept between slider moves, in the precision the equation was generated in
+	std::shared_ptr<PartialEvaluation<float>> float_partial;
+	std::shared_ptr<PartialEvaluation<double>> double_partial;
+	// the samples and heights of the last generation, which a generation over an overlapping domain reuses
+	std::shared_ptr<GridCache<float>> float_grid;
+	std::shared_ptr<GridCache<double>> double_grid;
+	int sweep_parameter = 0;
+	float sweep_from = 0.0f;
+	float sweep_to = 2.0f;
+	int sweep_frames = 200;
+	std::shared_ptr<ParameterSweep> sweep;
+	// evaluate heights in a generated vertex shader instead of on the CPU
+	bool gpu_evaluation = false;
+	std::shared_ptr<GpuSurface> gpu;
+	// why the equation is drawn from the CPU although gpu_evaluation is set
+	std::string gpu_error;
 };
 
 struct Point {
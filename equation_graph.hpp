@@ -0,0 +1,165 @@
+#ifndef EQUATION_GRAPH_H
+#define EQUATION_GRAPH_H
+
+#include "function_library.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Equations that refer to each other by name. An equation named f stands for its value at the same
+// x and y in the text of any other, so h = f - g draws the difference of two surfaces. Each
+// equation's source is its text with every reference replaced by the bracketed source of the
+// equation it names, which the lowering pipeline then compiles like any other expression. Sources
+// double with every level of an equation that uses another twice, so they are capped in size.
+class EquationGraph {
+public:
+	// longest source an equation may expand to
+	static const size_t max_source_size = 16384;
+
+	struct Node {
+		std::string name;
+		std::string text;
+		// indices of the equations the text refers to
+		std::vector<size_t> inputs;
+		// what the equation compiles; empty when error is set
+		std::string source;
+		std::string error;
+	};
+
+	// Replaces the graph with equations, given as (name, text) pairs; unnamed equations can refer to
+	// others but cannot be referred to. Names must be free for a parameter: not a variable, a library
+	// symbol or anything exprtk defines.
+	void build(const std::vector<std::pair<std::string, std::string>>& equations, const FunctionLibrary& library) {
+		nodes.clear();
+		index.clear();
+		order.clear();
+
+		for (const auto& equation : equations) {
+			Node node;
+			node.name = equation.first;
+			node.text = equation.second;
+			if (!node.name.empty()) {
+				const std::vector<std::string> free = library.free_symbols(node.name, { "x", "y", "z" });
+				if (free.size() != 1 || free[0] != node.name)
+					node.error = "'" + node.name + "' cannot name an equation";
+				else if (index.count(node.name))
+					node.error = "'" + node.name + "' names another equation";
+				else
+					index[node.name] = nodes.size();
+			}
+			nodes.push_back(node);
+		}
+
+		for (size_t i = 0; i < nodes.size(); i++) {
+			for (const auto& span : references(nodes[i].text)) {
+				const size_t input = index.at(nodes[i].text.substr(span.first, span.second));
+				if (std::find(nodes[i].inputs.begin(), nodes[i].inputs.end(), input) == nodes[i].inputs.end())
+					nodes[i].inputs.push_back(input);
+			}
+		}
+
+		std::vector<int> state(nodes.size(), 0);
+		for (size_t i = 0; i < nodes.size(); i++)
+			visit(i, state);
+		for (size_t i : order)
+			expand(nodes[i]);
+	}
+
+	size_t size() const {
+		return nodes.size();
+	}
+
+	const Node& node(size_t i) const {
+		return nodes[i];
+	}
+
+	// Equation i followed by every equation that depends on it, directly or not. Each comes after
+	// all of its inputs, so regenerating them in this order never reads a stale source.
+	std::vector<size_t> dependents(size_t i) const {
+		std::vector<bool> affected(nodes.size(), false);
+		affected[i] = true;
+		std::vector<size_t> result = { i };
+		for (size_t k : order) {
+			if (affected[k])
+				continue;
+			for (size_t input : nodes[k].inputs) {
+				if (affected[input]) {
+					affected[k] = true;
+					result.push_back(k);
+					break;
+				}
+			}
+		}
+		return result;
+	}
+
+private:
+	std::vector<Node> nodes;
+	std::unordered_map<std::string, size_t> index;
+	// every equation after the ones it refers to
+	std::vector<size_t> order;
+
+	// Identifiers in text that name an equation. Names followed by an opening bracket are calls of
+	// library functions, as in FunctionLibrary::free_symbols.
+	std::vector<std::pair<size_t, size_t>> references(const std::string& text) const {
+		std::vector<std::pair<size_t, size_t>> spans;
+		for (const auto& span : FunctionLibrary::identifier_spans(text)) {
+			size_t next = span.first + span.second;
+			while (next < text.size() && std::isspace(static_cast<unsigned char>(text[next])))
+				next++;
+			if (next < text.size() && text[next] == '(')
+				continue;
+			if (index.count(text.substr(span.first, span.second)))
+				spans.push_back(span);
+		}
+		return spans;
+	}
+
+	void visit(size_t i, std::vector<int>& state) {
+		if (state[i] == 2)
+			return;
+		if (state[i] == 1) {
+			nodes[i].error = "'" + nodes[i].name + "' refers to itself";
+			return;
+		}
+
+		state[i] = 1;
+		for (size_t input : nodes[i].inputs)
+			visit(input, state);
+		state[i] = 2;
+		order.push_back(i);
+	}
+
+	// Builds the source of node; its inputs have been expanded already.
+	void expand(Node& node) {
+		for (size_t input : node.inputs) {
+			if (node.error.empty() && !nodes[input].error.empty())
+				node.error = "uses '" + nodes[input].name + "', which has an error";
+		}
+		if (!node.error.empty())
+			return;
+
+		const std::vector<std::pair<size_t, size_t>> spans = references(node.text);
+		size_t size = node.text.size();
+		for (const auto& span : spans)
+			size += nodes[index.at(node.text.substr(span.first, span.second))].source.size() + 2 - span.second;
+		if (size > max_source_size) {
+			node.error = "expands to " + std::to_string(size) + " characters, more than " + std::to_string(max_source_size);
+			return;
+		}
+
+		size_t copied = 0;
+		for (const auto& span : spans) {
+			node.source += node.text.substr(copied, span.first - copied);
+			node.source += "(" + nodes[index.at(node.text.substr(span.first, span.second))].source + ")";
+			copied = span.first + span.second;
+		}
+		node.source += node.text.substr(copied);
+	}
+};
+
+#endif // !EQUATION_GRAPH_H
@@ -0,0 +1,464 @@
+#ifndef EXPRESSION_CACHE_H
+#define EXPRESSION_CACHE_H
+
+#include "exprtk.hpp"
+#include "expression_tree.hpp"
+#include "program.hpp"
+#include "simplify.hpp"
+#include "separable.hpp"
+#include "polynomial.hpp"
+#include "simd_eval.hpp"
+#include "vm.hpp"
+#include "dual.hpp"
+#include "function_library.hpp"
+#include "parameters.hpp"
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// One compiled equation evaluated in T (float or double). Programs keep their constants in double
+// so one lowering serves both precisions; native code and vector kernels exist for float only.
+template <typename T>
+struct CompiledExpression {
+	std::vector<std::string> variable_names;
+	std::unique_ptr<T[]> variables;
+	// set when the text uses library symbols; declared first so it outlives the expression
+	std::shared_ptr<ExprtkLibrary<T>> library;
+	exprtk::symbol_table<T> symbol_table;
+	exprtk::expression<T> expr;
+	bool valid = false;
+	std::string error;
+	std::shared_ptr<const Program> program;
+	// set when the program is x_program(x) + y_program(y) or x_program(x) * y_program(y)
+	Separation separation = Separation::None;
+	std::shared_ptr<const Program> x_program;
+	std::shared_ptr<const Program> y_program;
+	// set when the expression is a polynomial in x and y
+	std::shared_ptr<const Polynomial> polynomial;
+	// With parameters, program is parametric_program with their current values bound as constants.
+	// base_program computes the subtrees no parameter reaches, and residual_program finishes the
+	// value from x, y, z, the parameters and those subtrees.
+	std::shared_ptr<const Program> parametric_program;
+	std::shared_ptr<const Program> base_program;
+	std::shared_ptr<const Program> residual_program;
+	std::vector<T> registers;
+	std::vector<Dual<T>> dual_registers;
+	size_t parsed_operations = 0;
+	size_t simplified_operations = 0;
+
+	T& variable(size_t index) {
+		return variables[index];
+	}
+
+	T value() const {
+		return expr.value();
+	}
+
+	// Evaluates the bound variables on the bytecode VM when the expression lowered to a program,
+	// otherwise on exprtk.
+	T evaluate() {
+		if (!program)
+			return expr.value();
+		for (size_t i = 0; i < program->inputs.size(); i++)
+			registers[i] = variables[i];
+		return run_program(*program, registers.data());
+	}
+
+	// Evaluates the bound variables together with the derivatives along the first two of them.
+	// Without a program the derivatives are NaN and callers have to fall back to differencing.
+	Dual<T> evaluate_dual() {
+		if (!program)
+			return make_dual<T>(expr.value(), NAN, NAN);
+		for (size_t i = 0; i < program->inputs.size(); i++)
+			dual_registers[i] = make_dual<T>(variables[i], i == 0 ? 1 : 0, i == 1 ? 1 : 0);
+		return run_dual_program(*program, dual_registers.data());
+	}
+
+	// Sets the variables after x, y and z, and rebinds them into the program. Cheap enough to call
+	// for every change of a slider.
+	void set_parameters(const std::vector<double>& values) {
+		for (size_t i = 0; i < values.size() && first_parameter + i < variable_names.size(); i++)
+			variables[first_parameter + i] = static_cast<T>(values[i]);
+		if (!parametric_program)
+			return;
+
+		program = std::make_shared<Program>(bind_inputs(*parametric_program, first_parameter, values));
+		load_constants(*program, registers);
+		load_dual_constants(*program, dual_registers);
+	}
+};
+
+// Several expressions over the same variables lowered into one program. results[i] of the program is
+// the value of expression i, and subexpressions they have in common are evaluated once per sample.
+struct FusedProgram {
+	std::shared_ptr<const Program> program;
+	size_t operations = 0;
+	// what the expressions cost per sample when each runs on its own
+	size_t separate_operations = 0;
+};
+
+// Compiled expressions keyed on the expression text, the names of the variables bound to it and the
+// versions of the library symbols it uses. Entries are shared between equations, so identical text
+// is only ever parsed once. Threads that evaluate the same text concurrently ask for separate slots,
+// each with its own variable bindings; the copies for slots after the first live in the entry of the
+// first, so they neither count against the capacity nor outlive it. Library functions keep state
+// inside exprtk, so expressions that use them and did not lower to a program must stay on one thread.
+template <typename T>
+class ExpressionCache {
+public:
+	explicit ExpressionCache(size_t capacity = 256) : capacity(capacity) {}
+
+	void set_library(const FunctionLibrary* functions) {
+		std::lock_guard<std::mutex> lock(mutex);
+		library = functions;
+	}
+
+	std::shared_ptr<CompiledExpression<T>> get(const std::string& text, const std::vector<std::string>& variables, size_t slot = 0) {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		const std::string dependencies = library ? library->dependency_key(text) : std::string();
+		const std::string key = make_key(text, variables) + dependencies;
+
+		auto it = entries.find(key);
+		if (it != entries.end()) {
+			usage.splice(usage.begin(), usage, it->second.usage_it);
+		}
+		else {
+			usage.push_front(key);
+			it = entries.emplace(key, Entry{ compile(text, variables, true, !dependencies.empty()), {}, usage.begin() }).first;
+		}
+
+		Entry& entry = it->second;
+		std::shared_ptr<CompiledExpression<T>> compiled = entry.compiled;
+		if (slot > 0) {
+			if (entry.workers.size() < slot)
+				entry.workers.resize(slot);
+			if (!entry.workers[slot - 1])
+				entry.workers[slot - 1] = compile(text, variables, false, !dependencies.empty());
+			compiled = entry.workers[slot - 1];
+		}
+
+		while (entries.size() > capacity) {
+			entries.erase(usage.back());
+			usage.pop_back();
+		}
+
+		return compiled;
+	}
+
+	// Fuses texts into one program. Fails unless every text lowers on its own and each result of the
+	// fused program agrees with that text's own program.
+	bool fuse(const std::vector<std::string>& texts, const std::vector<std::string>& variables, FusedProgram& fused) {
+		std::vector<std::shared_ptr<CompiledExpression<T>>> parts;
+		for (const auto& text : texts) {
+			parts.push_back(get(text, variables));
+			if (!parts.back()->program)
+				return false;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		ExprTree forest;
+		forest.variables = variables;
+		std::vector<int> roots;
+		fused.separate_operations = 0;
+		for (size_t i = 0; i < texts.size(); i++) {
+			ExprTree tree;
+			if (!tree_parser.parse(texts[i], variables, tree, library ? &library->trees() : nullptr))
+				return false;
+			roots.push_back(forest.append(tree));
+			fused.separate_operations += parts[i]->simplified_operations;
+		}
+
+		const ExprTree simplified = simplifier.simplify(forest, roots);
+		Program lowered;
+		auto program = std::make_shared<Program>();
+		if (!lower_program(simplified, roots, lowered) || !compile_program(simplified, roots, *program))
+			return false;
+		if (!matches_parts(*program, parts))
+			return false;
+
+		fused.program = program;
+		fused.operations = lowered.code.size();
+		return true;
+	}
+
+	void clear() {
+		std::lock_guard<std::mutex> lock(mutex);
+		entries.clear();
+		usage.clear();
+	}
+
+	size_t size() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries.size();
+	}
+
+private:
+	struct Entry {
+		std::shared_ptr<CompiledExpression<T>> compiled;
+		// exprtk copies for slots 1 and up
+		std::vector<std::shared_ptr<CompiledExpression<T>>> workers;
+		std::list<std::string>::iterator usage_it;
+	};
+
+	size_t capacity;
+	std::mutex mutex;
+	const FunctionLibrary* library = nullptr;
+	exprtk::parser<T> parser;
+	ExpressionParser tree_parser;
+	ExpressionSimplifier simplifier;
+	SeparabilityAnalyzer separability;
+	PolynomialExtractor polynomial_extractor;
+	std::unordered_map<std::string, Entry> entries;
+	std::list<std::string> usage;
+
+	static std::string make_key(const std::string& text, const std::vector<std::string>& variables) {
+		std::string key = text;
+		for (const auto& name : variables) {
+			key += '\0';
+			key += name;
+		}
+		return key;
+	}
+
+	std::shared_ptr<CompiledExpression<T>> compile(const std::string& text, const std::vector<std::string>& variables, bool build_program, bool uses_library) {
+		const double e = 2.71828182845904523536028747135266249775724709369996;
+
+		auto compiled = std::make_shared<CompiledExpression<T>>();
+		compiled->variable_names = variables;
+		compiled->variables.reset(new T[variables.size()]());
+
+		compiled->symbol_table.add_constant("e", e);
+		compiled->symbol_table.add_pi();
+
+		for (size_t i = 0; i < variables.size(); i++) {
+			compiled->symbol_table.add_variable(variables[i], compiled->variables[i]);
+		}
+
+		compiled->expr.register_symbol_table(compiled->symbol_table);
+		if (uses_library) {
+			compiled->library = library->exprtk_library<T>();
+			compiled->expr.register_symbol_table(compiled->library->constants);
+			compiled->expr.register_symbol_table(compiled->library->compositor.symbol_table());
+		}
+		compiled->valid = parser.compile(text, compiled->expr);
+		if (!compiled->valid) {
+			compiled->error = parser.error();
+			return compiled;
+		}
+		if (!build_program)
+			return compiled;
+
+		ExprTree tree;
+		if (!tree_parser.parse(text, variables, tree, uses_library ? &library->trees() : nullptr))
+			return compiled;
+
+		const ExprTree simplified = simplifier.simplify(tree);
+		compiled->parsed_operations = count_operations(tree);
+		compiled->simplified_operations = count_operations(simplified);
+
+		auto program = std::make_shared<Program>();
+		if (compile_program(simplified, *program) && matches_exprtk(*compiled, *program)) {
+			compiled->program = program;
+			load_constants(*program, compiled->registers);
+			load_dual_constants(*program, compiled->dual_registers);
+
+			if (variables.size() > first_parameter) {
+				compiled->parametric_program = program;
+				partition(*compiled, simplified);
+				compiled->set_parameters(std::vector<double>(variables.size() - first_parameter, 0.0));
+				return compiled;
+			}
+
+			separate(*compiled, simplified);
+
+			Polynomial polynomial;
+			if (variables.size() == 3 && polynomial_extractor.extract(simplified, 0, 1, polynomial) && matches_polynomial(*program, polynomial))
+				compiled->polynomial = std::make_shared<Polynomial>(polynomial);
+		}
+
+		return compiled;
+	}
+
+	void separate(CompiledExpression<T>& compiled, const ExprTree& tree) {
+		SeparableForm form;
+		if (compiled.variable_names.size() != 3 || !separability.analyze(tree, 0, 1, form))
+			return;
+
+		auto x_program = std::make_shared<Program>();
+		auto y_program = std::make_shared<Program>();
+		if (!compile_program(form.x_part, *x_program) || !compile_program(form.y_part, *y_program))
+			return;
+		if (!matches_separated(*compiled.program, form.kind, *x_program, *y_program))
+			return;
+
+		compiled.separation = form.kind;
+		compiled.x_program = x_program;
+		compiled.y_program = y_program;
+	}
+
+	void partition(CompiledExpression<T>& compiled, const ExprTree& tree) {
+		ExprTree base, residual;
+		std::vector<int> base_roots;
+		if (!split_parameters(tree, base, base_roots, residual))
+			return;
+
+		auto base_program = std::make_shared<Program>();
+		auto residual_program = std::make_shared<Program>();
+		if (!compile_program(base, base_roots, *base_program) || !compile_program(residual, *residual_program))
+			return;
+		if (!matches_partition(*compiled.parametric_program, *base_program, *residual_program))
+			return;
+
+		compiled.base_program = base_program;
+		compiled.residual_program = residual_program;
+	}
+
+	static bool close_enough(T expected, T actual) {
+		if (std::isnan(expected) || std::isnan(actual))
+			return std::isnan(expected) && std::isnan(actual);
+		if (std::isinf(expected) || std::isinf(actual))
+			return expected == actual;
+		return std::abs(expected - actual) <= T(1e-4) * std::max(T(1), std::abs(expected));
+	}
+
+	static const size_t probe_count = 10;
+	static const size_t probe_samples = probe_count * probe_count;
+
+	// Values the checks below sample every variable at.
+	static const T* probes() {
+		static const T values[probe_count] = { T(-7.3), T(-2), T(-1), T(-0.5), T(0), T(0.25), T(1), T(1.5), T(3.7), T(12) };
+		return values;
+	}
+
+	// Inputs of a check over every pair of probes: sample k has x = probes()[k / probe_count] and
+	// y = probes()[k % probe_count]. Variables after y take shifted probes, or zero with zero_rest.
+	static std::vector<std::vector<T>> probe_grid(size_t variable_count, bool zero_rest = false) {
+		std::vector<std::vector<T>> inputs(variable_count, std::vector<T>(probe_samples, T(0)));
+		for (size_t k = 0; k < probe_samples; k++) {
+			for (size_t v = 0; v < variable_count; v++) {
+				if (v == 0)
+					inputs[v][k] = probes()[k / probe_count];
+				else if (v == 1)
+					inputs[v][k] = probes()[k % probe_count];
+				else if (!zero_rest)
+					inputs[v][k] = probes()[(k / probe_count + v * 3) % probe_count];
+			}
+		}
+		return inputs;
+	}
+
+	static std::vector<const T*> input_pointers(const std::vector<std::vector<T>>& vectors) {
+		std::vector<const T*> pointers;
+		for (const auto& vector : vectors)
+			pointers.push_back(vector.data());
+		return pointers;
+	}
+
+	static std::vector<T*> output_pointers(std::vector<std::vector<T>>& vectors) {
+		std::vector<T*> pointers;
+		for (auto& vector : vectors)
+			pointers.push_back(vector.data());
+		return pointers;
+	}
+
+	// Regrouping terms changes rounding, so the separated form is checked against the full program.
+	static bool matches_separated(const Program& program, Separation kind, const Program& x_program, const Program& y_program) {
+		std::vector<T> zeros(probe_count, T(0));
+		const T* x_inputs[] = { probes(), zeros.data(), zeros.data() };
+		const T* y_inputs[] = { zeros.data(), probes(), zeros.data() };
+		std::vector<T> fx(probe_count), gy(probe_count), combined(probe_samples);
+		evaluate_batch(x_program, x_inputs, fx.data(), probe_count);
+		evaluate_batch(y_program, y_inputs, gy.data(), probe_count);
+		combine_outer(kind, fx.data(), probe_count, gy.data(), probe_count, combined.data());
+
+		const std::vector<std::vector<T>> inputs = probe_grid(3, true);
+		std::vector<T> full(probe_samples);
+		evaluate_batch(program, input_pointers(inputs).data(), full.data(), probe_samples);
+
+		for (size_t i = 0; i < probe_samples; i++) {
+			if (!close_enough(full[i], combined[i]))
+				return false;
+		}
+		return true;
+	}
+
+	static bool matches_polynomial(const Program& program, const Polynomial& polynomial) {
+		const std::vector<std::vector<T>> inputs = probe_grid(3, true);
+		std::vector<T> full(probe_samples);
+		evaluate_batch(program, input_pointers(inputs).data(), full.data(), probe_samples);
+
+		for (size_t i = 0; i < probe_samples; i++) {
+			if (!close_enough(full[i], static_cast<T>(polynomial.evaluate(inputs[0][i], inputs[1][i]))))
+				return false;
+		}
+		return true;
+	}
+
+	static bool matches_partition(const Program& program, const Program& base, const Program& residual) {
+		const size_t variable_count = program.inputs.size();
+		std::vector<std::vector<T>> inputs = probe_grid(variable_count);
+		inputs.resize(variable_count + base.results.size(), std::vector<T>(probe_samples));
+		const std::vector<const T*> input_ptrs = input_pointers(inputs);
+		const std::vector<T*> all = output_pointers(inputs);
+		const std::vector<T*> cached_ptrs(all.begin() + variable_count, all.end());
+
+		std::vector<T> expected(probe_samples), actual(probe_samples);
+		evaluate_batch(program, input_ptrs.data(), expected.data(), probe_samples);
+		evaluate_batch_outputs(base, input_ptrs.data(), cached_ptrs.data(), probe_samples);
+		evaluate_batch(residual, input_ptrs.data(), actual.data(), probe_samples);
+		for (size_t i = 0; i < probe_samples; i++) {
+			if (!close_enough(expected[i], actual[i]))
+				return false;
+		}
+		return true;
+	}
+
+	static bool matches_parts(const Program& fused, const std::vector<std::shared_ptr<CompiledExpression<T>>>& parts) {
+		const std::vector<std::vector<T>> inputs = probe_grid(fused.inputs.size());
+		const std::vector<const T*> input_ptrs = input_pointers(inputs);
+
+		std::vector<std::vector<T>> results(parts.size(), std::vector<T>(probe_samples));
+		evaluate_batch_outputs(fused, input_ptrs.data(), output_pointers(results).data(), probe_samples);
+
+		std::vector<T> expected(probe_samples);
+		for (size_t p = 0; p < parts.size(); p++) {
+			evaluate_batch(*parts[p]->program, input_ptrs.data(), expected.data(), probe_samples);
+			for (size_t i = 0; i < probe_samples; i++) {
+				if (!close_enough(expected[i], results[p][i]))
+					return false;
+			}
+		}
+		return true;
+	}
+
+	// The tree parser only covers a subset of exprtk, so a lowered program is only trusted once it
+	// agrees with exprtk on a spread of probe points.
+	static bool matches_exprtk(CompiledExpression<T>& compiled, const Program& program) {
+		const size_t variable_count = compiled.variable_names.size();
+		const std::vector<std::vector<T>> inputs = probe_grid(variable_count);
+
+		std::vector<T> results(probe_samples);
+		evaluate_batch(program, input_pointers(inputs).data(), results.data(), probe_samples);
+
+		bool matches = true;
+		for (size_t i = 0; i < results.size() && matches; i++) {
+			for (size_t v = 0; v < variable_count; v++)
+				compiled.variable(v) = inputs[v][i];
+
+			matches = close_enough(compiled.value(), results[i]);
+		}
+
+		for (size_t v = 0; v < variable_count; v++)
+			compiled.variable(v) = T(0);
+		return matches;
+	}
+};
+
+#endif // !EXPRESSION_CACHE_H
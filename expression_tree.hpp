@@ -0,0 +1,462 @@
+#ifndef EXPRESSION_TREE_H
+#define EXPRESSION_TREE_H
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class Op : uint8_t {
+	Const,
+	Var,
+	Neg,
+	Add,
+	Sub,
+	Mul,
+	Div,
+	Mod,
+	Pow,
+	Lt,
+	Le,
+	Gt,
+	Ge,
+	Eq,
+	Ne,
+	And,
+	Or,
+	Not,
+	Select,
+	Min,
+	Max,
+	Atan2,
+	Hypot,
+	Abs,
+	Sqrt,
+	Exp,
+	Log,
+	Log10,
+	Log2,
+	Sin,
+	Cos,
+	Tan,
+	Asin,
+	Acos,
+	Atan,
+	Sinh,
+	Cosh,
+	Tanh,
+	Floor,
+	Ceil,
+	Round,
+	Trunc,
+	Sgn,
+	// fused forms, only produced by fuse_instructions()
+	MulAdd,
+	Square,
+	SumSquares,
+};
+
+inline int op_arity(Op op) {
+	switch (op) {
+	case Op::Const:
+	case Op::Var:
+		return 0;
+	case Op::Add:
+	case Op::Sub:
+	case Op::Mul:
+	case Op::Div:
+	case Op::Mod:
+	case Op::Pow:
+	case Op::Lt:
+	case Op::Le:
+	case Op::Gt:
+	case Op::Ge:
+	case Op::Eq:
+	case Op::Ne:
+	case Op::And:
+	case Op::Or:
+	case Op::Min:
+	case Op::Max:
+	case Op::Atan2:
+	case Op::Hypot:
+	case Op::SumSquares:
+		return 2;
+	case Op::Select:
+	case Op::MulAdd:
+		return 3;
+	default:
+		return 1;
+	}
+}
+
+// Const nodes keep their value in value, Var nodes the index into ExprTree::variables.
+struct ExprNode {
+	Op op = Op::Const;
+	int args[3] = { -1, -1, -1 };
+	double value = 0.0;
+	int variable = -1;
+};
+
+struct ExprTree {
+	std::vector<ExprNode> nodes;
+	std::vector<std::string> variables;
+	int root = -1;
+
+	int add(const ExprNode& node) {
+		nodes.push_back(node);
+		return static_cast<int>(nodes.size()) - 1;
+	}
+
+	int constant(double value) {
+		ExprNode node;
+		node.op = Op::Const;
+		node.value = value;
+		return add(node);
+	}
+
+	int variable(int index) {
+		ExprNode node;
+		node.op = Op::Var;
+		node.variable = index;
+		return add(node);
+	}
+
+	int unary(Op op, int a) {
+		ExprNode node;
+		node.op = op;
+		node.args[0] = a;
+		return add(node);
+	}
+
+	int binary(Op op, int a, int b) {
+		ExprNode node;
+		node.op = op;
+		node.args[0] = a;
+		node.args[1] = b;
+		return add(node);
+	}
+
+	int ternary(Op op, int a, int b, int c) {
+		ExprNode node;
+		node.op = op;
+		node.args[0] = a;
+		node.args[1] = b;
+		node.args[2] = c;
+		return add(node);
+	}
+
+	// Copies the nodes of a tree over the same variables and returns where its root landed.
+	int append(const ExprTree& other) {
+		const int offset = static_cast<int>(nodes.size());
+		for (ExprNode node : other.nodes) {
+			for (int i = 0; i < op_arity(node.op); i++)
+				node.args[i] += offset;
+			nodes.push_back(node);
+		}
+		return other.root + offset;
+	}
+};
+
+// Named trees whose variables are their parameters, expanded in place wherever they are used.
+typedef std::unordered_map<std::string, ExprTree> TreeDefinitions;
+
+// Recursive descent parser for the part of exprtk's grammar that equations actually use.
+// Anything it does not understand is rejected so the caller can stay on exprtk for it.
+class ExpressionParser {
+public:
+	bool parse(const std::string& text, const std::vector<std::string>& variables, ExprTree& tree, const TreeDefinitions* definitions = nullptr) {
+		source = text;
+		pos = 0;
+		out = &tree;
+		tree = ExprTree();
+		tree.variables = variables;
+		failed = false;
+		inline_definitions = definitions;
+
+		tree.root = parse_conditional();
+		skip_space();
+		if (failed || pos != source.size() || tree.root < 0)
+			return false;
+		return true;
+	}
+
+private:
+	struct Function {
+		const char* name;
+		Op op;
+		int arity;
+	};
+
+	std::string source;
+	size_t pos = 0;
+	ExprTree* out = nullptr;
+	bool failed = false;
+	const TreeDefinitions* inline_definitions = nullptr;
+
+	int fail() {
+		failed = true;
+		return -1;
+	}
+
+	// Copies a definition into the tree with its parameters bound to args.
+	int expand(const std::string& name, const std::vector<int>& args) {
+		if (!inline_definitions)
+			return fail();
+		auto it = inline_definitions->find(name);
+		if (it == inline_definitions->end() || it->second.variables.size() != args.size())
+			return fail();
+
+		const ExprTree& body = it->second;
+		std::vector<int> copied(body.nodes.size(), -1);
+		for (size_t i = 0; i < body.nodes.size(); i++) {
+			ExprNode node = body.nodes[i];
+			if (node.op == Op::Var) {
+				copied[i] = args[node.variable];
+				continue;
+			}
+			for (int a = 0; a < op_arity(node.op); a++)
+				node.args[a] = copied[node.args[a]];
+			copied[i] = out->add(node);
+		}
+		return copied[body.root];
+	}
+
+	void skip_space() {
+		while (pos < source.size() && std::isspace(static_cast<unsigned char>(source[pos])))
+			pos++;
+	}
+
+	bool accept(const char* token) {
+		skip_space();
+		const size_t length = std::char_traits<char>::length(token);
+		if (source.compare(pos, length, token) != 0)
+			return false;
+		if (std::isalpha(static_cast<unsigned char>(token[0]))) {
+			const size_t end = pos + length;
+			if (end < source.size() && (std::isalnum(static_cast<unsigned char>(source[end])) || source[end] == '_'))
+				return false;
+		}
+		pos += length;
+		return true;
+	}
+
+	bool peek_word(const char* word) {
+		const size_t saved = pos;
+		const bool found = accept(word);
+		pos = saved;
+		return found;
+	}
+
+	bool starts_operand() {
+		skip_space();
+		if (pos >= source.size())
+			return false;
+		const char c = source[pos];
+		if (c == '(' || c == '.' || std::isdigit(static_cast<unsigned char>(c)))
+			return true;
+		if (std::isalpha(static_cast<unsigned char>(c)) || c == '_')
+			return !peek_word("and") && !peek_word("or") && !peek_word("not");
+		return false;
+	}
+
+	int parse_conditional() {
+		int condition = parse_or();
+		if (accept("?")) {
+			int when_true = parse_conditional();
+			if (!accept(":"))
+				return fail();
+			int when_false = parse_conditional();
+			return out->ternary(Op::Select, condition, when_true, when_false);
+		}
+		return condition;
+	}
+
+	int parse_or() {
+		int left = parse_and();
+		while (!failed && accept("or")) {
+			left = out->binary(Op::Or, left, parse_and());
+		}
+		return left;
+	}
+
+	int parse_and() {
+		int left = parse_comparison();
+		while (!failed && accept("and")) {
+			left = out->binary(Op::And, left, parse_comparison());
+		}
+		return left;
+	}
+
+	int parse_comparison() {
+		int left = parse_sum();
+		while (!failed) {
+			Op op;
+			if (accept("<=")) op = Op::Le;
+			else if (accept(">=")) op = Op::Ge;
+			else if (accept("<>") || accept("!=")) op = Op::Ne;
+			else if (accept("==") || accept("=")) op = Op::Eq;
+			else if (accept("<")) op = Op::Lt;
+			else if (accept(">")) op = Op::Gt;
+			else break;
+			left = out->binary(op, left, parse_sum());
+		}
+		return left;
+	}
+
+	int parse_sum() {
+		int left = parse_product();
+		while (!failed) {
+			if (accept("+")) left = out->binary(Op::Add, left, parse_product());
+			else if (accept("-")) left = out->binary(Op::Sub, left, parse_product());
+			else break;
+		}
+		return left;
+	}
+
+	int parse_product() {
+		int left = parse_unary();
+		while (!failed) {
+			if (accept("*")) left = out->binary(Op::Mul, left, parse_unary());
+			else if (accept("/")) left = out->binary(Op::Div, left, parse_unary());
+			else if (accept("%")) left = out->binary(Op::Mod, left, parse_unary());
+			else if (starts_operand()) left = out->binary(Op::Mul, left, parse_power());
+			else break;
+		}
+		return left;
+	}
+
+	int parse_unary() {
+		if (accept("-"))
+			return out->unary(Op::Neg, parse_unary());
+		if (accept("+"))
+			return parse_unary();
+		if (accept("not")) {
+			if (!accept("("))
+				return fail();
+			int arg = parse_conditional();
+			if (!accept(")"))
+				return fail();
+			return out->unary(Op::Not, arg);
+		}
+		return parse_power();
+	}
+
+	int parse_power() {
+		int base = parse_primary();
+		if (!failed && accept("^"))
+			return out->binary(Op::Pow, base, parse_unary());
+		return base;
+	}
+
+	int parse_number() {
+		const char* begin = source.c_str() + pos;
+		char* end = nullptr;
+		const double value = std::strtod(begin, &end);
+		if (end == begin)
+			return fail();
+
+		for (const char* c = begin; c != end; c++) {
+			if (*c == 'x' || *c == 'X' || *c == 'p' || *c == 'P')
+				return fail();
+		}
+
+		pos += end - begin;
+		return out->constant(value);
+	}
+
+	std::string parse_identifier() {
+		const size_t begin = pos;
+		while (pos < source.size() && (std::isalnum(static_cast<unsigned char>(source[pos])) || source[pos] == '_'))
+			pos++;
+		return source.substr(begin, pos - begin);
+	}
+
+	int parse_primary() {
+		skip_space();
+		if (pos >= source.size())
+			return fail();
+
+		const char c = source[pos];
+		if (c == '(') {
+			pos++;
+			int inner = parse_conditional();
+			if (!accept(")"))
+				return fail();
+			return inner;
+		}
+		if (std::isdigit(static_cast<unsigned char>(c)) || c == '.')
+			return parse_number();
+		if (!std::isalpha(static_cast<unsigned char>(c)) && c != '_')
+			return fail();
+
+		const std::string name = parse_identifier();
+		if (accept("("))
+			return parse_call(name);
+
+		for (size_t i = 0; i < out->variables.size(); i++) {
+			if (out->variables[i] == name)
+				return out->variable(static_cast<int>(i));
+		}
+		if (name == "pi")
+			return out->constant(3.14159265358979323846264338327950288419716939937510);
+		if (name == "e")
+			return out->constant(2.71828182845904523536028747135266249775724709369996);
+		return expand(name, {});
+	}
+
+	int parse_call(const std::string& name) {
+		static const Function functions[] = {
+			{ "abs", Op::Abs, 1 }, { "sqrt", Op::Sqrt, 1 }, { "exp", Op::Exp, 1 },
+			{ "log", Op::Log, 1 }, { "log10", Op::Log10, 1 }, { "log2", Op::Log2, 1 },
+			{ "sin", Op::Sin, 1 }, { "cos", Op::Cos, 1 }, { "tan", Op::Tan, 1 },
+			{ "asin", Op::Asin, 1 }, { "acos", Op::Acos, 1 }, { "atan", Op::Atan, 1 },
+			{ "sinh", Op::Sinh, 1 }, { "cosh", Op::Cosh, 1 }, { "tanh", Op::Tanh, 1 },
+			{ "floor", Op::Floor, 1 }, { "ceil", Op::Ceil, 1 }, { "round", Op::Round, 1 },
+			{ "trunc", Op::Trunc, 1 }, { "sgn", Op::Sgn, 1 },
+			{ "pow", Op::Pow, 2 }, { "atan2", Op::Atan2, 2 }, { "hypot", Op::Hypot, 2 },
+			{ "if", Op::Select, 3 },
+		};
+
+		std::vector<int> args;
+		if (!accept(")")) {
+			do {
+				args.push_back(parse_conditional());
+				if (failed)
+					return -1;
+			} while (accept(","));
+			if (!accept(")"))
+				return fail();
+		}
+
+		if ((name == "min" || name == "max") && !args.empty()) {
+			const Op op = name == "min" ? Op::Min : Op::Max;
+			int result = args[0];
+			for (size_t i = 1; i < args.size(); i++) {
+				result = out->binary(op, result, args[i]);
+			}
+			return result;
+		}
+		if (name == "clamp" && args.size() == 3) {
+			return out->binary(Op::Min, out->binary(Op::Max, args[1], args[0]), args[2]);
+		}
+
+		for (const auto& function : functions) {
+			if (name != function.name)
+				continue;
+			if (static_cast<int>(args.size()) != function.arity)
+				return fail();
+
+			ExprNode node;
+			node.op = function.op;
+			for (int i = 0; i < function.arity; i++) {
+				node.args[i] = args[i];
+			}
+			return out->add(node);
+		}
+		return expand(name, args);
+	}
+};
+
+#endif // !EXPRESSION_TREE_H
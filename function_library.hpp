@@ -0,0 +1,357 @@
+#ifndef FUNCTION_LIBRARY_H
+#define FUNCTION_LIBRARY_H
+
+#include "exprtk.hpp"
+#include "expression_tree.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// The library compiled for exprtk in one precision. Equations register these tables by reference,
+// so they must outlive every expression that does; CompiledExpression holds a shared_ptr for that.
+template <typename T>
+struct ExprtkLibrary {
+	exprtk::symbol_table<T> constants;
+	exprtk::function_compositor<T> compositor;
+
+	ExprtkLibrary() {
+		constants.add_constant("e", T(2.71828182845904523536028747135266249775724709369996));
+		compositor.add_auxiliary_symtab(constants);
+	}
+
+	ExprtkLibrary(const ExprtkLibrary&) = delete;
+	ExprtkLibrary& operator=(const ExprtkLibrary&) = delete;
+};
+
+// User-defined functions and constants shared by every equation, written one per line as
+// "g(t) = exp(-t^2)" or "k = 3.7". The whole library is compiled once per change: into inlinable
+// trees for the lowering pipeline and into an exprtk compositor for the fallback path.
+class FunctionLibrary {
+public:
+	struct Definition {
+		std::string name;
+		std::vector<std::string> parameters;
+		std::string body;
+		std::vector<std::string> dependencies;
+		// changes whenever the definition or anything it depends on changes
+		size_t version = 0;
+		std::string error;
+	};
+
+	// exprtk composes functions of at most this many parameters
+	static const size_t max_parameters = 6;
+
+	// Replaces every definition with those in source. Returns the names whose meaning changed,
+	// including removed ones.
+	std::vector<std::string> define(const std::string& source) {
+		std::unordered_map<std::string, size_t> previous;
+		for (const Definition& definition : entries)
+			previous[definition.name] = definition.version;
+
+		text = source;
+		entries.clear();
+		index.clear();
+
+		std::istringstream lines(source);
+		std::string line;
+		while (std::getline(lines, line)) {
+			Definition definition;
+			if (!parse_definition(line, definition))
+				continue;
+			if (definition.error.empty() && index.count(definition.name))
+				definition.error = "'" + definition.name + "' is already defined";
+			if (definition.error.empty())
+				index[definition.name] = entries.size();
+			entries.push_back(definition);
+		}
+
+		for (Definition& definition : entries) {
+			for (const std::string& name : identifiers(definition.body)) {
+				if (index.count(name) && std::find(definition.dependencies.begin(), definition.dependencies.end(), name) == definition.dependencies.end())
+					definition.dependencies.push_back(name);
+			}
+		}
+
+		std::vector<size_t> order;
+		std::vector<int> state(entries.size(), 0);
+		for (size_t i = 0; i < entries.size(); i++)
+			visit(i, state, order);
+
+		inline_trees.clear();
+		float_library = std::make_shared<ExprtkLibrary<float>>();
+		double_library = std::make_shared<ExprtkLibrary<double>>();
+		for (size_t i : order)
+			compile(entries[i]);
+
+		std::vector<std::string> changed;
+		for (const Definition& definition : entries) {
+			auto it = previous.find(definition.name);
+			if (it == previous.end() || it->second != definition.version)
+				changed.push_back(definition.name);
+			if (it != previous.end())
+				previous.erase(it);
+		}
+		for (const auto& removed : previous)
+			changed.push_back(removed.first);
+		return changed;
+	}
+
+	const std::string& source() const {
+		return text;
+	}
+
+	const std::vector<Definition>& definitions() const {
+		return entries;
+	}
+
+	bool empty() const {
+		return entries.empty();
+	}
+
+	// Trees of every definition that lowered, keyed on name, with parameters as the tree variables.
+	const TreeDefinitions& trees() const {
+		return inline_trees;
+	}
+
+	template <typename T>
+	std::shared_ptr<ExprtkLibrary<T>> exprtk_library() const {
+		if constexpr (std::is_same<T, float>::value)
+			return float_library;
+		else
+			return double_library;
+	}
+
+	// Names and versions of the library symbols text refers to; empty when it uses none. Expressions
+	// are cached under this key, so redefining a symbol only recompiles the equations that use it.
+	std::string dependency_key(const std::string& expression) const {
+		std::string key;
+		for (const std::string& name : identifiers(expression)) {
+			auto it = index.find(name);
+			if (it == index.end() || key.find('\0' + name + '@') != std::string::npos)
+				continue;
+			key += '\0' + name + '@' + std::to_string(entries[it->second].version);
+		}
+		return key;
+	}
+
+	// Identifiers in text that name nothing yet: not one of variables, a library symbol or anything
+	// exprtk defines. Names followed by an opening bracket are calls and are left out.
+	std::vector<std::string> free_symbols(const std::string& expression, const std::vector<std::string>& variables) const {
+		std::vector<std::string> names;
+		for (const auto& span : identifier_spans(expression)) {
+			const std::string name = expression.substr(span.first, span.second);
+			size_t next = span.first + span.second;
+			while (next < expression.size() && std::isspace(static_cast<unsigned char>(expression[next])))
+				next++;
+			if (next < expression.size() && expression[next] == '(')
+				continue;
+			if (std::find(variables.begin(), variables.end(), name) != variables.end() || index.count(name) || is_reserved(name) ||
+				exprtk::details::is_reserved_word(name) || std::find(names.begin(), names.end(), name) != names.end())
+				continue;
+			names.push_back(name);
+		}
+		return names;
+	}
+
+	// Every identifier in text.
+	static std::vector<std::string> identifiers(const std::string& text) {
+		std::vector<std::string> names;
+		for (const auto& span : identifier_spans(text))
+			names.push_back(text.substr(span.first, span.second));
+		return names;
+	}
+
+	// Start and length of every identifier in text, skipping the exponents of numbers such as 1e5.
+	static std::vector<std::pair<size_t, size_t>> identifier_spans(const std::string& text) {
+		std::vector<std::pair<size_t, size_t>> spans;
+		size_t pos = 0;
+		while (pos < text.size()) {
+			const unsigned char c = text[pos];
+			if (std::isdigit(c) || c == '.') {
+				while (pos < text.size() && (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '.'))
+					pos++;
+			}
+			else if (std::isalpha(c) || c == '_') {
+				const size_t begin = pos;
+				while (pos < text.size() && (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_'))
+					pos++;
+				spans.emplace_back(begin, pos - begin);
+			}
+			else {
+				pos++;
+			}
+		}
+		return spans;
+	}
+
+private:
+	std::string text;
+	std::vector<Definition> entries;
+	std::unordered_map<std::string, size_t> index;
+	TreeDefinitions inline_trees;
+	std::shared_ptr<ExprtkLibrary<float>> float_library = std::make_shared<ExprtkLibrary<float>>();
+	std::shared_ptr<ExprtkLibrary<double>> double_library = std::make_shared<ExprtkLibrary<double>>();
+	ExpressionParser tree_parser;
+
+	static bool is_identifier(const std::string& name) {
+		if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])))
+			return false;
+		for (char c : name) {
+			if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_')
+				return false;
+		}
+		return true;
+	}
+
+	static std::string trim(const std::string& s) {
+		size_t begin = 0, end = s.size();
+		while (begin < end && std::isspace(static_cast<unsigned char>(s[begin])))
+			begin++;
+		while (end > begin && std::isspace(static_cast<unsigned char>(s[end - 1])))
+			end--;
+		return s.substr(begin, end - begin);
+	}
+
+	// Names the library cannot take: the equation variables and anything exprtk already defines.
+	static bool is_reserved(const std::string& name) {
+		static const char* const names[] = { "x", "y", "z", "e", "pi", "epsilon", "inf" };
+		for (const char* reserved : names) {
+			if (name == reserved)
+				return true;
+		}
+		return exprtk::details::is_reserved_symbol(name) || exprtk::details::is_base_function(name);
+	}
+
+	// Returns false for blank lines. Malformed lines come back with error set.
+	static bool parse_definition(const std::string& line, Definition& definition) {
+		const std::string trimmed = trim(line);
+		if (trimmed.empty())
+			return false;
+
+		const size_t equals = trimmed.find('=');
+		const size_t open = trimmed.find('(');
+		if (equals == std::string::npos) {
+			definition.name = trimmed;
+			definition.error = "expected 'name = value' or 'name(parameters) = body'";
+			return true;
+		}
+
+		std::string head = trim(trimmed.substr(0, equals));
+		definition.body = trim(trimmed.substr(equals + 1));
+		if (open != std::string::npos && open < equals) {
+			const size_t close = head.find(')');
+			if (close == std::string::npos || close != head.size() - 1) {
+				definition.name = head;
+				definition.error = "unclosed parameter list";
+				return true;
+			}
+			std::istringstream parameters(head.substr(open + 1, close - open - 1));
+			std::string parameter;
+			while (std::getline(parameters, parameter, ',')) {
+				parameter = trim(parameter);
+				if (!parameter.empty())
+					definition.parameters.push_back(parameter);
+			}
+			head = trim(head.substr(0, open));
+		}
+		definition.name = head;
+
+		if (!is_identifier(definition.name))
+			definition.error = "'" + definition.name + "' is not a valid name";
+		else if (is_reserved(definition.name))
+			definition.error = "'" + definition.name + "' is a reserved name";
+		else if (definition.parameters.size() > max_parameters)
+			definition.error = "at most " + std::to_string(max_parameters) + " parameters are supported";
+		else if (definition.body.empty())
+			definition.error = "missing body";
+
+		for (const std::string& parameter : definition.parameters) {
+			if (definition.error.empty() && !is_identifier(parameter))
+				definition.error = "'" + parameter + "' is not a valid parameter name";
+		}
+		return true;
+	}
+
+	// Depth-first ordering so that every definition compiles after the ones it uses.
+	void visit(size_t i, std::vector<int>& state, std::vector<size_t>& order) {
+		if (state[i] == 2)
+			return;
+		if (state[i] == 1) {
+			entries[i].error = "'" + entries[i].name + "' refers to itself";
+			return;
+		}
+
+		state[i] = 1;
+		for (const std::string& name : entries[i].dependencies)
+			visit(index[name], state, order);
+		state[i] = 2;
+		order.push_back(i);
+	}
+
+	void compile(Definition& definition) {
+		std::string signature = definition.name + '(';
+		for (const std::string& parameter : definition.parameters)
+			signature += parameter + ',';
+		signature += ')' + definition.body;
+		for (const std::string& name : definition.dependencies) {
+			const Definition& dependency = entries[index[name]];
+			signature += '\0' + std::to_string(dependency.version);
+			if (definition.error.empty() && !dependency.error.empty())
+				definition.error = "uses '" + name + "', which has an error";
+		}
+		definition.version = std::hash<std::string>()(signature);
+		if (!definition.error.empty())
+			return;
+
+		for (const std::string& parameter : definition.parameters) {
+			if (index.count(parameter)) {
+				definition.error = "parameter '" + parameter + "' hides a library name";
+				return;
+			}
+		}
+
+		if (!compile_exprtk(*float_library, definition) || !compile_exprtk(*double_library, definition))
+			return;
+
+		ExprTree tree;
+		if (tree_parser.parse(definition.body, definition.parameters, tree, &inline_trees))
+			inline_trees[definition.name] = tree;
+	}
+
+	template <typename T>
+	bool compile_exprtk(ExprtkLibrary<T>& library, Definition& definition) {
+		if (!definition.parameters.empty()) {
+			typename exprtk::function_compositor<T>::function function(definition.name);
+			function.expression(definition.body);
+			for (const std::string& parameter : definition.parameters)
+				function.var(parameter);
+			if (!library.compositor.add(function)) {
+				definition.error = library.compositor.error();
+				return false;
+			}
+			return true;
+		}
+
+		// constants are evaluated once and stored, so equations see them as literals
+		exprtk::expression<T> expression;
+		expression.register_symbol_table(library.constants);
+		expression.register_symbol_table(library.compositor.symbol_table());
+		exprtk::parser<T> parser;
+		if (!parser.compile(definition.body, expression)) {
+			definition.error = parser.error();
+			return false;
+		}
+		library.constants.add_constant(definition.name, expression.value());
+		return true;
+	}
+};
+
+#endif // !FUNCTION_LIBRARY_H
@@ -0,0 +1,205 @@
+#ifndef GLSL_H
+#define GLSL_H
+
+#include "parameters.hpp"
+#include "program.hpp"
+#include "shader.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+// GLSL arrays need a fixed size, so equations with more parameters stay on the CPU.
+const size_t max_gpu_parameters = 32;
+
+// Vertices per axis of the grid a GPU surface is drawn on.
+const int max_gpu_resolution = 2048;
+
+// An equation evaluated in its own vertex shader. The vertex buffer holds a grid over [0, 1] that the
+// shader maps onto the bounds, so moving a bound or a parameter only changes uniforms.
+struct GpuSurface {
+	// the program the shader was generated from
+	std::shared_ptr<const Program> source;
+	std::shared_ptr<Shader> shader;
+	size_t parameter_count = 0;
+
+	// owned by the render thread, like the buffers of a sweep
+	unsigned int vertex_array = 0;
+	unsigned int grid_buffer = 0;
+	int resolution = 0;
+	bool is_3d = true;
+	size_t vertex_count = 0;
+};
+
+// Float literal GLSL reads back as the same value. GLSL has no literals for infinity and NaN.
+inline std::string glsl_literal(double value) {
+	const float narrowed = static_cast<float>(value);
+	if (std::isnan(narrowed))
+		return "uintBitsToFloat(0x7fc00000u)";
+	if (std::isinf(narrowed))
+		return narrowed > 0 ? "uintBitsToFloat(0x7f800000u)" : "uintBitsToFloat(0xff800000u)";
+
+	char text[32];
+	std::snprintf(text, sizeof(text), "%.9g", narrowed);
+	std::string literal = text;
+	if (literal.find_first_of(".e") == std::string::npos)
+		literal += ".0";
+	return narrowed < 0 ? "(" + literal + ")" : literal;
+}
+
+// Functions the generated code calls where GLSL's builtins differ from apply_op: pow is undefined
+// for negative bases and for zero to a non-positive power, mod floors instead of truncating, and
+// round may go either way at halves.
+const char glsl_helpers[] = R"(
+float planar_pow(float a, float b) {
+    if (b == 0.0 || a == 1.0)
+        return 1.0;
+    if (isnan(a) || isnan(b))
+        return uintBitsToFloat(0x7fc00000u);
+    if (a == 0.0)
+        return b > 0.0 ? 0.0 : uintBitsToFloat(0x7f800000u);
+    float magnitude = exp2(b * log2(abs(a)));
+    if (a > 0.0)
+        return magnitude;
+    if (floor(b) != b)
+        return uintBitsToFloat(0x7fc00000u);
+    return mod(b, 2.0) == 1.0 ? -magnitude : magnitude;
+}
+
+float planar_fmod(float a, float b) {
+    return a - b * trunc(a / b);
+}
+
+float planar_round(float a) {
+    return a < 0.0 ? ceil(a - 0.5) : floor(a + 0.5);
+}
+
+bool planar_equal(float a, float b) {
+    return abs(a - b) <= max(1.0, max(abs(a), abs(b))) * 0.000001;
+}
+)";
+
+// Writes program as the GLSL function "float equation(float x, float y, float z)". Inputs after z
+// are read from the uniform array parameters. Returns false with the reason in error when the
+// program holds something the translation does not cover.
+inline bool transpile_glsl(const Program& program, std::string& source, std::string& error) {
+	if (program.inputs.size() > first_parameter + max_gpu_parameters) {
+		error = "more than " + std::to_string(max_gpu_parameters) + " parameters";
+		return false;
+	}
+
+	auto reg = [](uint16_t r) {
+		return "r" + std::to_string(r);
+	};
+
+	source = "float equation(float x, float y, float z) {\n";
+	const char* const axes[] = { "x", "y", "z" };
+	for (size_t i = 0; i < program.inputs.size(); i++) {
+		const std::string input = i < first_parameter ? axes[i] : "parameters[" + std::to_string(i - first_parameter) + "]";
+		source += "    float " + reg(static_cast<uint16_t>(i)) + " = " + input + ";\n";
+	}
+	for (size_t i = 0; i < program.constants.size(); i++)
+		source += "    float " + reg(static_cast<uint16_t>(program.first_constant() + i)) + " = " + glsl_literal(program.constants[i]) + ";\n";
+	for (size_t r = program.first_constant() + program.constants.size(); r < program.register_count; r++)
+		source += "    float " + reg(static_cast<uint16_t>(r)) + ";\n";
+
+	for (const Instruction& ins : program.code) {
+		const std::string a = reg(ins.a);
+		const std::string b = reg(ins.b);
+		const std::string c = reg(ins.c);
+		std::string value;
+		switch (ins.op) {
+		case Op::Neg: value = "-" + a; break;
+		case Op::Add: value = a + " + " + b; break;
+		case Op::Sub: value = a + " - " + b; break;
+		case Op::Mul: value = a + " * " + b; break;
+		case Op::Div: value = a + " / " + b; break;
+		case Op::Mod: value = "planar_fmod(" + a + ", " + b + ")"; break;
+		case Op::Pow: value = "planar_pow(" + a + ", " + b + ")"; break;
+		case Op::Lt: value = "float(" + a + " < " + b + ")"; break;
+		case Op::Le: value = "float(" + a + " <= " + b + ")"; break;
+		case Op::Gt: value = "float(" + a + " > " + b + ")"; break;
+		case Op::Ge: value = "float(" + a + " >= " + b + ")"; break;
+		case Op::Eq: value = "float(planar_equal(" + a + ", " + b + "))"; break;
+		case Op::Ne: value = "float(!planar_equal(" + a + ", " + b + "))"; break;
+		case Op::And: value = "float(" + a + " != 0.0 && " + b + " != 0.0)"; break;
+		case Op::Or: value = "float(" + a + " != 0.0 || " + b + " != 0.0)"; break;
+		case Op::Not: value = "float(" + a + " == 0.0)"; break;
+		case Op::Select: value = a + " != 0.0 ? " + b + " : " + c; break;
+		case Op::Min: value = "min(" + a + ", " + b + ")"; break;
+		case Op::Max: value = "max(" + a + ", " + b + ")"; break;
+		case Op::Atan2: value = "atan(" + a + ", " + b + ")"; break;
+		case Op::Hypot: value = "sqrt(" + a + " * " + a + " + " + b + " * " + b + ")"; break;
+		case Op::Abs: value = "abs(" + a + ")"; break;
+		case Op::Sqrt: value = "sqrt(" + a + ")"; break;
+		case Op::Exp: value = "exp(" + a + ")"; break;
+		case Op::Log: value = "log(" + a + ")"; break;
+		case Op::Log10: value = "log2(" + a + ") * 0.301029996"; break;
+		case Op::Log2: value = "log2(" + a + ")"; break;
+		case Op::Sin: value = "sin(" + a + ")"; break;
+		case Op::Cos: value = "cos(" + a + ")"; break;
+		case Op::Tan: value = "tan(" + a + ")"; break;
+		case Op::Asin: value = "asin(" + a + ")"; break;
+		case Op::Acos: value = "acos(" + a + ")"; break;
+		case Op::Atan: value = "atan(" + a + ")"; break;
+		case Op::Sinh: value = "sinh(" + a + ")"; break;
+		case Op::Cosh: value = "cosh(" + a + ")"; break;
+		case Op::Tanh: value = "tanh(" + a + ")"; break;
+		case Op::Floor: value = "floor(" + a + ")"; break;
+		case Op::Ceil: value = "ceil(" + a + ")"; break;
+		case Op::Round: value = "planar_round(" + a + ")"; break;
+		case Op::Trunc: value = "trunc(" + a + ")"; break;
+		case Op::Sgn: value = "sign(" + a + ")"; break;
+		case Op::MulAdd: value = a + " * " + b + " + " + c; break;
+		case Op::Square: value = a + " * " + a; break;
+		case Op::SumSquares: value = a + " * " + a + " + " + b + " * " + b; break;
+		default:
+			error = "operation " + std::to_string(static_cast<int>(ins.op)) + " has no GLSL form";
+			return false;
+		}
+		source += "    " + reg(ins.dst) + " = " + value + ";\n";
+	}
+	source += "    return " + reg(program.result) + ";\n}\n";
+	return true;
+}
+
+// The vertex shader of a GPU surface: the same outputs as shader.vs, with the position computed from
+// a grid vertex by the transpiled equation. Heights outside the Z range or without a value are moved
+// outside the clip volume.
+inline std::string gpu_vertex_shader(const std::string& function, size_t parameter_count) {
+	std::string source = "#version 330 core\n"
+		"layout (location = 0) in vec2 aGrid;\n"
+		"\n"
+		"uniform mat4 model;\n"
+		"uniform mat4 view;\n"
+		"uniform mat4 projection;\n"
+		"uniform float point_size;\n"
+		"uniform vec3 color;\n"
+		"uniform vec2 x_range;\n"
+		"uniform vec2 y_range;\n"
+		"uniform vec2 z_range;\n";
+	if (parameter_count > 0)
+		source += "uniform float parameters[" + std::to_string(parameter_count) + "];\n";
+	source += "\n"
+		"out vec3 ourColor;\n"
+		"out float heightY;\n";
+	source += glsl_helpers;
+	source += "\n" + function + "\n";
+	source += "void main()\n"
+		"{\n"
+		"    ourColor = color;\n"
+		"    gl_PointSize = point_size;\n"
+		"    float x = mix(x_range.x, x_range.y, aGrid.x);\n"
+		"    float y = mix(y_range.x, y_range.y, aGrid.y);\n"
+		"    float height = equation(x, y, 0.0);\n"
+		"    vec4 worldPos = model * vec4(x, height, y, 1.0);\n"
+		"    heightY = worldPos.y;\n"
+		"    gl_Position = projection * view * worldPos;\n"
+		"    if (isnan(height) || isinf(height) || height < z_range.x || height > z_range.y)\n"
+		"        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"
+		"}\n";
+	return source;
+}
+
+#endif // !GLSL_H
@@ -0,0 +1,88 @@
+#ifndef GRID_CACHE_H
+#define GRID_CACHE_H
+
+#include "program.hpp"
+#include "simd_eval.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// The base samples of one axis: count samples at origin + k * spacing, from k = first on. Positions
+// are always computed with this one expression, so two lattices that share an origin and spacing
+// produce bit-identical samples wherever their ranges of k overlap.
+template <typename T>
+struct AxisLattice {
+	T origin = T(0);
+	T spacing = T(0);
+	long long first = 0;
+	size_t count = 0;
+
+	T sample(size_t i) const {
+		return origin + T(first + static_cast<long long>(i)) * spacing;
+	}
+};
+
+// Places sample_size base samples over [min, max]. The lattice of the previous generation is kept
+// when the new domain has the same spacing, to rounding, and starts a whole number of steps from its
+// origin, which is the case when the domain was panned by whole samples; the two grids then share
+// every sample where they overlap. Otherwise a new lattice starts at min.
+template <typename T>
+AxisLattice<T> place_lattice(T min, T max, int sample_size, const AxisLattice<T>* previous) {
+	const size_t count = static_cast<size_t>(std::max(sample_size, 2));
+	const T spacing = (max - min) / T(count - 1);
+
+	AxisLattice<T> lattice;
+	lattice.count = count;
+	if (previous && previous->spacing > T(0) && std::abs(spacing - previous->spacing) <= T(1e-5) * previous->spacing) {
+		const T steps = (min - previous->origin) / previous->spacing;
+		if (std::abs(steps - std::round(steps)) <= T(1e-3)) {
+			lattice.origin = previous->origin;
+			lattice.spacing = previous->spacing;
+			lattice.first = std::llround(steps);
+			return lattice;
+		}
+	}
+
+	lattice.origin = min;
+	lattice.spacing = spacing;
+	return lattice;
+}
+
+// The samples and heights of an equation's last generation, with what they were evaluated under.
+// A later generation over an overlapping domain takes every sample it shares with this one from here.
+template <typename T>
+struct GridCache {
+	std::shared_ptr<const Program> program;
+	MathAccuracy accuracy = MathAccuracy::Exact;
+	bool is_3d = true;
+	int sample_size = 0;
+	// heights outside the z range may hold placeholders, so they are only valid for the same range
+	float min_z = 0.0f;
+	float max_z = 0.0f;
+
+	AxisLattice<T> x_lattice;
+	AxisLattice<T> y_lattice;
+	std::vector<T> x_samples;
+	std::vector<T> y_samples;
+	std::vector<T> heights;
+};
+
+// For every sample of axis, its index in previous, or -1 when previous does not have it. Both axes
+// are sorted, so one merge finds every match.
+template <typename T>
+std::vector<ptrdiff_t> match_samples(const std::vector<T>& previous, const std::vector<T>& axis) {
+	std::vector<ptrdiff_t> matches(axis.size(), -1);
+	size_t j = 0;
+	for (size_t i = 0; i < axis.size(); i++) {
+		while (j < previous.size() && previous[j] < axis[i])
+			j++;
+		if (j < previous.size() && previous[j] == axis[i])
+			matches[i] = static_cast<ptrdiff_t>(j);
+	}
+	return matches;
+}
+
+#endif // !GRID_CACHE_H
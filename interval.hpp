@@ -0,0 +1,291 @@
+#ifndef INTERVAL_H
+#define INTERVAL_H
+
+#include "program.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// A guaranteed range for a value over a box of inputs. lo and hi bound every non-NaN result, and nan
+// is set when some input in the box may produce NaN. Bounds are computed in double and widened by a
+// float ulp after inexact operations, so they also cover the rounding of float evaluation.
+struct Interval {
+	double lo = 0.0;
+	double hi = 0.0;
+	bool nan = false;
+};
+
+inline Interval make_interval(double lo, double hi, bool nan = false) {
+	Interval r;
+	r.lo = std::isnan(lo) ? -std::numeric_limits<double>::infinity() : lo;
+	r.hi = std::isnan(hi) ? std::numeric_limits<double>::infinity() : hi;
+	r.nan = nan || std::isnan(lo) || std::isnan(hi);
+	return r;
+}
+
+inline Interval entire_interval(bool nan) {
+	const double inf = std::numeric_limits<double>::infinity();
+	return make_interval(-inf, inf, nan);
+}
+
+inline Interval hull(const Interval& a, const Interval& b) {
+	return make_interval(std::min(a.lo, b.lo), std::max(a.hi, b.hi), a.nan || b.nan);
+}
+
+inline bool contains(const Interval& a, double value) {
+	return a.lo <= value && value <= a.hi;
+}
+
+inline bool bounded(const Interval& a) {
+	return std::isfinite(a.lo) && std::isfinite(a.hi);
+}
+
+// Float results round to the nearest float, underflow to zero and overflow to infinity.
+inline Interval widen(Interval a) {
+	const double inf = std::numeric_limits<double>::infinity();
+	a.lo = a.lo < -FLT_MAX ? -inf : a.lo - std::abs(a.lo) * FLT_EPSILON - FLT_MIN;
+	a.hi = a.hi > FLT_MAX ? inf : a.hi + std::abs(a.hi) * FLT_EPSILON + FLT_MIN;
+	return a;
+}
+
+// Bounds of a monotone function over a.
+inline Interval increasing(const Interval& a, double (*f)(double)) {
+	return widen(make_interval(f(a.lo), f(a.hi), a.nan));
+}
+
+inline Interval decreasing(const Interval& a, double (*f)(double)) {
+	return widen(make_interval(f(a.hi), f(a.lo), a.nan));
+}
+
+// Restricts a to [lo, hi] for functions that are NaN outside that domain.
+inline Interval clip_domain(const Interval& a, double lo, double hi, bool& nan) {
+	nan = a.nan || a.lo < lo || a.hi > hi;
+	return make_interval(std::max(a.lo, lo), std::min(a.hi, hi), nan);
+}
+
+inline Interval interval_add(const Interval& a, const Interval& b) {
+	return widen(make_interval(a.lo + b.lo, a.hi + b.hi, a.nan || b.nan || !bounded(a) || !bounded(b)));
+}
+
+inline Interval interval_neg(const Interval& a) {
+	return make_interval(-a.hi, -a.lo, a.nan);
+}
+
+inline Interval interval_mul(const Interval& a, const Interval& b) {
+	// 0 * inf is NaN, but as a limit the product of the two bounds is 0
+	auto product = [](double x, double y) { const double p = x * y; return std::isnan(p) ? 0.0 : p; };
+	const double p[] = { product(a.lo, b.lo), product(a.lo, b.hi), product(a.hi, b.lo), product(a.hi, b.hi) };
+	const bool nan = a.nan || b.nan || (!bounded(a) && contains(b, 0.0)) || (!bounded(b) && contains(a, 0.0));
+	return widen(make_interval(*std::min_element(p, p + 4), *std::max_element(p, p + 4), nan));
+}
+
+inline Interval interval_square(const Interval& a) {
+	const double l = a.lo * a.lo;
+	const double h = a.hi * a.hi;
+	if (contains(a, 0.0))
+		return widen(make_interval(0.0, std::max(l, h), a.nan));
+	return widen(make_interval(std::min(l, h), std::max(l, h), a.nan));
+}
+
+inline Interval interval_div(const Interval& a, const Interval& b) {
+	if (contains(b, 0.0))
+		return entire_interval(a.nan || b.nan || contains(a, 0.0) || !bounded(a));
+	Interval reciprocal = make_interval(1.0 / b.hi, 1.0 / b.lo, b.nan);
+	return interval_mul(a, widen(reciprocal));
+}
+
+inline Interval interval_sqrt(const Interval& a) {
+	bool nan;
+	const Interval d = clip_domain(a, 0.0, std::numeric_limits<double>::infinity(), nan);
+	if (d.lo > d.hi)
+		return make_interval(0.0, 0.0, true);
+	return increasing(make_interval(d.lo, d.hi, nan), std::sqrt);
+}
+
+inline Interval interval_log(const Interval& a, double (*f)(double)) {
+	bool nan;
+	const Interval d = clip_domain(a, 0.0, std::numeric_limits<double>::infinity(), nan);
+	if (d.lo > d.hi)
+		return make_interval(0.0, 0.0, true);
+	return increasing(make_interval(d.lo, d.hi, nan), f);
+}
+
+// sin over a, using that sin reaches 1 at pi/2 + 2k pi and -1 at -pi/2 + 2k pi.
+inline Interval interval_sin(const Interval& a) {
+	const double pi = 3.14159265358979323846;
+	if (!bounded(a) || a.hi - a.lo >= 2.0 * pi)
+		return make_interval(-1.0, 1.0, a.nan || !bounded(a));
+
+	double lo = std::min(std::sin(a.lo), std::sin(a.hi));
+	double hi = std::max(std::sin(a.lo), std::sin(a.hi));
+	if (std::floor((a.hi - pi / 2.0) / (2.0 * pi)) != std::floor((a.lo - pi / 2.0) / (2.0 * pi)))
+		hi = 1.0;
+	if (std::floor((a.hi + pi / 2.0) / (2.0 * pi)) != std::floor((a.lo + pi / 2.0) / (2.0 * pi)))
+		lo = -1.0;
+	return widen(make_interval(std::max(lo - FLT_EPSILON, -1.0), std::min(hi + FLT_EPSILON, 1.0), a.nan));
+}
+
+inline Interval interval_cos(const Interval& a) {
+	const double pi = 3.14159265358979323846;
+	return interval_sin(make_interval(a.lo + pi / 2.0, a.hi + pi / 2.0, a.nan));
+}
+
+inline Interval interval_tan(const Interval& a) {
+	const double pi = 3.14159265358979323846;
+	if (!bounded(a) || std::floor((a.lo + pi / 2.0) / pi) != std::floor((a.hi + pi / 2.0) / pi))
+		return entire_interval(a.nan || !bounded(a));
+	return increasing(a, std::tan);
+}
+
+inline Interval interval_pow(const Interval& a, const Interval& b) {
+	if (b.lo == b.hi && b.lo == std::floor(b.lo) && std::abs(b.lo) <= 64.0) {
+		const double n = b.lo;
+		if (n == 0.0)
+			return make_interval(1.0, 1.0, a.nan || b.nan);
+		if (n < 0.0)
+			return interval_div(make_interval(1.0, 1.0), interval_pow(a, make_interval(-n, -n, b.nan)));
+
+		const double l = std::pow(a.lo, n);
+		const double h = std::pow(a.hi, n);
+		if (std::fmod(n, 2.0) != 0.0)
+			return widen(make_interval(l, h, a.nan || b.nan));
+		if (contains(a, 0.0))
+			return widen(make_interval(0.0, std::max(l, h), a.nan || b.nan));
+		return widen(make_interval(std::min(l, h), std::max(l, h), a.nan || b.nan));
+	}
+
+	// a^b = exp(b * log(a)) over the non-negative part of a. A negative base is NaN for a fixed
+	// non-integer exponent, but could be anything once the exponent range holds integers.
+	const bool fractional = b.lo == b.hi && b.lo != std::floor(b.lo);
+	if (a.hi < 0.0)
+		return fractional ? make_interval(0.0, 0.0, true) : entire_interval(true);
+	const bool negative_base = a.lo < 0.0;
+	Interval base = make_interval(std::max(a.lo, 0.0), a.hi, a.nan);
+	Interval result = interval_mul(b, interval_log(base, std::log));
+	result = increasing(result, std::exp);
+	if (contains(base, 0.0))
+		result = hull(result, make_interval(0.0, 0.0));
+	result.nan = result.nan || negative_base || b.nan;
+	if (negative_base && !fractional)
+		result = hull(result, entire_interval(true));
+	return result;
+}
+
+inline Interval truth_interval(bool can_be_false, bool can_be_true) {
+	return make_interval(can_be_true && !can_be_false ? 1.0 : 0.0, can_be_true ? 1.0 : 0.0);
+}
+
+inline bool may_be_true(const Interval& a) {
+	return a.nan || a.lo != 0.0 || a.hi != 0.0;
+}
+
+inline bool may_be_false(const Interval& a) {
+	return contains(a, 0.0);
+}
+
+inline Interval apply_interval(Op op, const Interval& a, const Interval& b, const Interval& c) {
+	const double pi = 3.14159265358979323846;
+	const bool compare_nan = a.nan || b.nan;
+
+	switch (op) {
+	case Op::Neg: return interval_neg(a);
+	case Op::Add: return interval_add(a, b);
+	case Op::Sub: return interval_add(a, interval_neg(b));
+	case Op::Mul: return interval_mul(a, b);
+	case Op::Div: return interval_div(a, b);
+	case Op::Mod: {
+		const double m = std::max(std::abs(b.lo), std::abs(b.hi));
+		const bool nan = a.nan || b.nan || contains(b, 0.0) || !bounded(a);
+		return make_interval(a.lo >= 0.0 ? 0.0 : std::max(a.lo, -m), a.hi <= 0.0 ? 0.0 : std::min(a.hi, m), nan);
+	}
+	case Op::Pow: return interval_pow(a, b);
+	case Op::Lt: return compare_nan ? truth_interval(true, true) : truth_interval(a.hi >= b.lo, a.lo < b.hi);
+	case Op::Le: return compare_nan ? truth_interval(true, true) : truth_interval(a.hi > b.lo, a.lo <= b.hi);
+	case Op::Gt: return compare_nan ? truth_interval(true, true) : truth_interval(a.lo <= b.hi, a.hi > b.lo);
+	case Op::Ge: return compare_nan ? truth_interval(true, true) : truth_interval(a.lo < b.hi, a.hi >= b.lo);
+	case Op::Eq:
+	case Op::Ne: {
+		const double scale = std::max({ 1.0, std::abs(a.lo), std::abs(a.hi), std::abs(b.lo), std::abs(b.hi) });
+		const double tolerance = scale * 2.0 * epsilon_for<float>();
+		const bool apart = a.hi + tolerance < b.lo || b.hi + tolerance < a.lo;
+		const bool may_equal = compare_nan || !apart;
+		const bool may_differ = compare_nan || !(a.lo == a.hi && b.lo == b.hi && a.lo == b.lo);
+		return op == Op::Eq ? truth_interval(may_differ, may_equal) : truth_interval(may_equal, may_differ);
+	}
+	case Op::And: return truth_interval(may_be_false(a) || may_be_false(b), may_be_true(a) && may_be_true(b));
+	case Op::Or: return truth_interval(may_be_false(a) && may_be_false(b), may_be_true(a) || may_be_true(b));
+	case Op::Not: return truth_interval(may_be_true(a), may_be_false(a));
+	case Op::Select:
+		if (!may_be_false(a)) return b;
+		if (!may_be_true(a)) return c;
+		return hull(b, c);
+	// std::min and std::max return their first operand when either one is NaN
+	case Op::Min: return make_interval(std::min(a.lo, b.lo), b.nan ? a.hi : std::min(a.hi, b.hi), a.nan);
+	case Op::Max: return make_interval(b.nan ? a.lo : std::max(a.lo, b.lo), std::max(a.hi, b.hi), a.nan);
+	case Op::Atan2: return make_interval(-pi - FLT_EPSILON * 4.0, pi + FLT_EPSILON * 4.0, a.nan || b.nan);
+	case Op::Hypot: return interval_sqrt(interval_add(interval_square(a), interval_square(b)));
+	case Op::Abs:
+		if (a.lo >= 0.0) return a;
+		if (a.hi <= 0.0) return interval_neg(a);
+		return make_interval(0.0, std::max(-a.lo, a.hi), a.nan);
+	case Op::Sqrt: return interval_sqrt(a);
+	case Op::Exp: return increasing(a, std::exp);
+	case Op::Log: return interval_log(a, std::log);
+	case Op::Log10: return interval_log(a, std::log10);
+	case Op::Log2: return interval_log(a, std::log2);
+	case Op::Sin: return interval_sin(a);
+	case Op::Cos: return interval_cos(a);
+	case Op::Tan: return interval_tan(a);
+	case Op::Asin: {
+		bool nan;
+		const Interval d = clip_domain(a, -1.0, 1.0, nan);
+		return d.lo > d.hi ? make_interval(0.0, 0.0, true) : increasing(d, std::asin);
+	}
+	case Op::Acos: {
+		bool nan;
+		const Interval d = clip_domain(a, -1.0, 1.0, nan);
+		return d.lo > d.hi ? make_interval(0.0, 0.0, true) : decreasing(d, std::acos);
+	}
+	case Op::Atan: return increasing(a, std::atan);
+	case Op::Sinh: return increasing(a, std::sinh);
+	case Op::Cosh: {
+		const Interval magnitude = apply_interval(Op::Abs, a, a, a);
+		return increasing(magnitude, std::cosh);
+	}
+	case Op::Tanh: return increasing(a, std::tanh);
+	case Op::Floor: return make_interval(std::floor(a.lo), std::floor(a.hi), a.nan);
+	case Op::Ceil: return make_interval(std::ceil(a.lo), std::ceil(a.hi), a.nan);
+	case Op::Round: return make_interval(std::floor(a.lo - 0.5), std::ceil(a.hi + 0.5), a.nan);
+	case Op::Trunc: return make_interval(std::trunc(a.lo), std::trunc(a.hi), a.nan);
+	case Op::Sgn: {
+		// sgn(NaN) is 0
+		const double lo = a.lo < 0.0 ? -1.0 : (a.lo > 0.0 && !a.nan ? 1.0 : 0.0);
+		const double hi = a.hi > 0.0 ? 1.0 : (a.hi < 0.0 && !a.nan ? -1.0 : 0.0);
+		return make_interval(lo, hi);
+	}
+	case Op::MulAdd: return interval_add(interval_mul(a, b), c);
+	case Op::Square: return interval_square(a);
+	case Op::SumSquares: return interval_add(interval_square(a), interval_square(b));
+	default: return entire_interval(true);
+	}
+}
+
+// Bounds a Program over the box given by one interval per input.
+inline Interval evaluate_interval(const Program& program, const Interval* inputs) {
+	thread_local std::vector<Interval> registers;
+	registers.assign(program.register_count, Interval());
+
+	for (size_t i = 0; i < program.inputs.size(); i++)
+		registers[i] = inputs[i];
+	for (size_t i = 0; i < program.constants.size(); i++)
+		registers[program.first_constant() + i] = make_interval(program.constants[i], program.constants[i]);
+
+	for (const Instruction& ins : program.code)
+		registers[ins.dst] = apply_interval(ins.op, registers[ins.a], registers[ins.b], registers[ins.c]);
+	return registers[program.result];
+}
+
+#endif // !INTERVAL_H
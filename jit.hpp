@@ -0,0 +1,246 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "program.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define PLANAR_JIT_X64 1
+#else
+#define PLANAR_JIT_X64 0
+#endif
+
+// Operations the JIT leaves to compiled C++ instead of emitting inline.
+template <Op op>
+float jit_helper(float a, float b, float c) {
+	return apply_op<float>(op, a, b, c);
+}
+
+typedef float (*JitHelper)(float, float, float);
+
+inline JitHelper jit_helper_for(Op op) {
+	switch (op) {
+#define PLANAR_JIT_HELPER(name) case Op::name: return &jit_helper<Op::name>
+		PLANAR_JIT_HELPER(Mod); PLANAR_JIT_HELPER(Pow); PLANAR_JIT_HELPER(Eq); PLANAR_JIT_HELPER(Ne);
+		PLANAR_JIT_HELPER(And); PLANAR_JIT_HELPER(Or); PLANAR_JIT_HELPER(Not); PLANAR_JIT_HELPER(Select);
+		PLANAR_JIT_HELPER(Atan2); PLANAR_JIT_HELPER(Hypot); PLANAR_JIT_HELPER(Exp); PLANAR_JIT_HELPER(Log);
+		PLANAR_JIT_HELPER(Log10); PLANAR_JIT_HELPER(Log2); PLANAR_JIT_HELPER(Sin); PLANAR_JIT_HELPER(Cos);
+		PLANAR_JIT_HELPER(Tan); PLANAR_JIT_HELPER(Asin); PLANAR_JIT_HELPER(Acos); PLANAR_JIT_HELPER(Atan);
+		PLANAR_JIT_HELPER(Sinh); PLANAR_JIT_HELPER(Cosh); PLANAR_JIT_HELPER(Tanh); PLANAR_JIT_HELPER(Floor);
+		PLANAR_JIT_HELPER(Ceil); PLANAR_JIT_HELPER(Round); PLANAR_JIT_HELPER(Trunc); PLANAR_JIT_HELPER(Sgn);
+#undef PLANAR_JIT_HELPER
+	default: return nullptr;
+	}
+}
+
+// Native x86-64 code for one Program. The generated function takes the VM register file (inputs and
+// constants already loaded), works on it through rbx with scalar SSE, and returns the result in xmm0.
+// Only the backend benchmark runs it: surfaces are sampled by the batch evaluator, which already
+// outpaces scalar native code, so nothing is drawn through the JIT.
+class JitFunction {
+public:
+	typedef float (*Entry)(float* registers);
+
+	static bool supported() {
+		return PLANAR_JIT_X64 != 0;
+	}
+
+	static std::unique_ptr<JitFunction> compile(const Program& program) {
+		if (!supported())
+			return nullptr;
+
+		std::unique_ptr<JitFunction> function(new JitFunction());
+		if (!function->emit_program(program) || !function->finalize())
+			return nullptr;
+		return function;
+	}
+
+	~JitFunction() {
+		if (!memory)
+			return;
+#if defined(_WIN32)
+		VirtualFree(memory, 0, MEM_RELEASE);
+#else
+		munmap(memory, memory_size);
+#endif
+	}
+
+	JitFunction(const JitFunction&) = delete;
+	JitFunction& operator=(const JitFunction&) = delete;
+
+	float operator()(float* registers) const {
+		return entry(registers);
+	}
+
+	size_t code_size() const {
+		return code.size();
+	}
+
+private:
+	// constant pool at the start of the buffer, addressed rip-relative
+	enum PoolSlot { SignMask = 0, AbsMask = 4, One = 8, PoolSize = 16 };
+
+	std::vector<uint8_t> code;
+	void* memory = nullptr;
+	size_t memory_size = 0;
+	Entry entry = nullptr;
+
+	JitFunction() = default;
+
+	void byte(uint8_t value) {
+		code.push_back(value);
+	}
+
+	void bytes(std::initializer_list<uint8_t> values) {
+		code.insert(code.end(), values.begin(), values.end());
+	}
+
+	void u32(uint32_t value) {
+		for (int i = 0; i < 4; i++)
+			byte(static_cast<uint8_t>(value >> (8 * i)));
+	}
+
+	void u64(uint64_t value) {
+		for (int i = 0; i < 8; i++)
+			byte(static_cast<uint8_t>(value >> (8 * i)));
+	}
+
+	// <prefix> 0F <opcode> xmm, [rbx + reg * 4]
+	void sse_mem(uint8_t prefix, uint8_t opcode, int xmm, uint16_t reg) {
+		if (prefix)
+			byte(prefix);
+		bytes({ 0x0F, opcode, static_cast<uint8_t>(0x80 | (xmm << 3) | 3) });
+		u32(static_cast<uint32_t>(reg) * 4);
+	}
+
+	// <prefix> 0F <opcode> xmm_dst, xmm_src
+	void sse_reg(uint8_t prefix, uint8_t opcode, int dst, int src) {
+		if (prefix)
+			byte(prefix);
+		bytes({ 0x0F, opcode, static_cast<uint8_t>(0xC0 | (dst << 3) | src) });
+	}
+
+	// movss xmm, [rip + pool slot]
+	void load_pool(int xmm, PoolSlot slot) {
+		bytes({ 0xF3, 0x0F, 0x10, static_cast<uint8_t>(0x05 | (xmm << 3)) });
+		const int64_t next = static_cast<int64_t>(code.size()) + 4;
+		u32(static_cast<uint32_t>(static_cast<int32_t>(slot - next)));
+	}
+
+	void load(int xmm, uint16_t reg) { sse_mem(0xF3, 0x10, xmm, reg); }
+	void store(int xmm, uint16_t reg) { sse_mem(0xF3, 0x11, xmm, reg); }
+
+	void compare(uint16_t a, uint16_t b, uint8_t predicate) {
+		load(0, a);
+		sse_mem(0xF3, 0xC2, 0, b);
+		byte(predicate);
+		load_pool(1, One);
+		sse_reg(0, 0x54, 0, 1);
+	}
+
+	bool emit_program(const Program& program) {
+		const float one = 1.0f;
+		const uint32_t sign_mask = 0x80000000u;
+		const uint32_t abs_mask = 0x7FFFFFFFu;
+		code.resize(PoolSize, 0);
+		std::memcpy(&code[SignMask], &sign_mask, 4);
+		std::memcpy(&code[AbsMask], &abs_mask, 4);
+		std::memcpy(&code[One], &one, 4);
+
+		// push rbx; sub rsp, 32 (keeps rsp 16-byte aligned and leaves Win64 shadow space for calls)
+		byte(0x53);
+		bytes({ 0x48, 0x83, 0xEC, 0x20 });
+#if defined(_WIN32)
+		bytes({ 0x48, 0x89, 0xCB });
+#else
+		bytes({ 0x48, 0x89, 0xFB });
+#endif
+
+		for (const Instruction& ins : program.code) {
+			switch (ins.op) {
+			case Op::Add: load(0, ins.a); sse_mem(0xF3, 0x58, 0, ins.b); break;
+			case Op::Sub: load(0, ins.a); sse_mem(0xF3, 0x5C, 0, ins.b); break;
+			case Op::Mul: load(0, ins.a); sse_mem(0xF3, 0x59, 0, ins.b); break;
+			case Op::Div: load(0, ins.a); sse_mem(0xF3, 0x5E, 0, ins.b); break;
+			case Op::Min: load(0, ins.b); sse_mem(0xF3, 0x5D, 0, ins.a); break;
+			case Op::Max: load(0, ins.b); sse_mem(0xF3, 0x5F, 0, ins.a); break;
+			case Op::Sqrt: sse_mem(0xF3, 0x51, 0, ins.a); break;
+			case Op::Neg: load(0, ins.a); load_pool(1, SignMask); sse_reg(0, 0x57, 0, 1); break;
+			case Op::Abs: load(0, ins.a); load_pool(1, AbsMask); sse_reg(0, 0x54, 0, 1); break;
+			case Op::Square: load(0, ins.a); sse_reg(0xF3, 0x59, 0, 0); break;
+			case Op::MulAdd: load(0, ins.a); sse_mem(0xF3, 0x59, 0, ins.b); sse_mem(0xF3, 0x58, 0, ins.c); break;
+			case Op::SumSquares:
+				load(0, ins.a);
+				sse_reg(0xF3, 0x59, 0, 0);
+				load(1, ins.b);
+				sse_reg(0xF3, 0x59, 1, 1);
+				sse_reg(0xF3, 0x58, 0, 1);
+				break;
+			case Op::Lt: compare(ins.a, ins.b, 1); break;
+			case Op::Le: compare(ins.a, ins.b, 2); break;
+			case Op::Gt: compare(ins.b, ins.a, 1); break;
+			case Op::Ge: compare(ins.b, ins.a, 2); break;
+			default: {
+				const JitHelper helper = jit_helper_for(ins.op);
+				if (!helper)
+					return false;
+				const int arity = op_arity(ins.op);
+				load(0, ins.a);
+				if (arity > 1) load(1, ins.b);
+				if (arity > 2) load(2, ins.c);
+				// mov rax, helper; call rax
+				bytes({ 0x48, 0xB8 });
+				u64(reinterpret_cast<uint64_t>(helper));
+				bytes({ 0xFF, 0xD0 });
+				break;
+			}
+			}
+			store(0, ins.dst);
+		}
+
+		load(0, program.result);
+		// add rsp, 32; pop rbx; ret
+		bytes({ 0x48, 0x83, 0xC4, 0x20 });
+		byte(0x5B);
+		byte(0xC3);
+		return true;
+	}
+
+	bool finalize() {
+#if defined(_WIN32)
+		memory_size = code.size();
+		memory = VirtualAlloc(nullptr, memory_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (!memory)
+			return false;
+		std::memcpy(memory, code.data(), code.size());
+		DWORD old_protect;
+		if (!VirtualProtect(memory, memory_size, PAGE_EXECUTE_READ, &old_protect))
+			return false;
+		FlushInstructionCache(GetCurrentProcess(), memory, memory_size);
+#else
+		memory_size = code.size();
+		void* mapped = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapped == MAP_FAILED)
+			return false;
+		memory = mapped;
+		std::memcpy(memory, code.data(), code.size());
+		if (mprotect(memory, memory_size, PROT_READ | PROT_EXEC) != 0)
+			return false;
+#endif
+		entry = reinterpret_cast<Entry>(static_cast<uint8_t*>(memory) + PoolSize);
+		return true;
+	}
+};
+
+#endif // !JIT_H
@@ -6,7 +6,16 @@
 #include <GLFW/glfw3.h>
 #include "camera.hpp"
 #include "exprtk.hpp"
+#include "expression_cache.hpp"
+#include "thread_pool.hpp"
+#include "benchmark.hpp"
+#include "interval.hpp"
 #include "updater.hpp"
+#include "preview.hpp"
+#include "derivative.hpp"
+#include "mesh_cache.hpp"
+#include "equation_graph.hpp"
+#include <chrono>
 #include <cstring>
 #include "stb_image.h"
 
@@ -28,22 +37,58 @@ float min_x_val = -100;
 float max_x_val = 100;
 float min_y_val = -100;
 float max_y_val = 100;
+float min_z_val = -100;
+float max_z_val = 100;
 float max_view_distance = 250.0f;
 float point_size = 1.0f;
 int max_depth = 6;
 double derivative_threshold = 5.0;
+bool show_benchmark = false;
+bool show_library = false;
+bool animate = true;
+// milliseconds of each frame spent re-evaluating equations that use t
+float animation_budget = 4.0f;
 
 char import_filepath[256] = "";
 char export_filepath[256] = "";
+char library_buf[4096] = "";
 
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-GLuint VAO, VBO, EBO;
+GLuint VAO = 0, VBO = 0, EBO = 0;
+GLsizeiptr vertex_capacity = 0;
+GLsizeiptr index_capacity = 0;
 std::vector<glm::vec3> points_vec;
 std::vector<unsigned int> indices_vec;
 std::vector<Equation> equations;
 std::vector<Point> points;
+// equations built while the equation list is drawn, appended once it is done
+std::vector<Equation> derived_equations;
+// references between equations, rebuilt whenever names or texts may have changed
+EquationGraph equation_graph;
+std::vector<BenchmarkResult> benchmark_results;
+std::vector<MathBenchmarkResult> math_benchmark_results;
+ExpressionCache<float> expression_cache;
+ExpressionCache<double> double_expression_cache;
+PreviewCompiler preview_compiler;
+// meshes of earlier runs, so reopening a scene does not evaluate it again
+bool use_disk_cache = true;
+int disk_cache_megabytes = 256;
+DiskMeshCache disk_cache("mesh_cache");
+// meshes of recent generations, so toggling a setting back does not evaluate it again
+int memory_cache_megabytes = 128;
+MemoryMeshCache memory_cache;
+FunctionLibrary function_library;
+// operations per sample in the last Render All, for the equations it fused
+size_t fused_equations = 0;
+size_t fused_operations = 0;
+size_t separate_operations = 0;
+ThreadPool thread_pool;
+const size_t tile_size = 64;
+const size_t leaf_size = 8;
+// columns per worker evaluated between checks of the animation budget
+const size_t animation_chunk = 8;
 
 void processInput(GLFWwindow* window) {
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -108,234 +153,1540 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 	glViewport(0, 0, width, height);
 }
 
-void generate_vertices(Equation& equation) {
-	exprtk::symbol_table<float> symbol_table;
-	exprtk::expression<float> expr;
-	exprtk::parser<float> parser;
-
-	float spacing_tolerance = 0.001f;
-	float stepX = (equation.max_x - equation.min_x) / equation.sample_size;
-	float stepY = (equation.max_y - equation.min_y) / equation.sample_size;
-
-	const double e = 2.71828182845904523536028747135266249775724709369996;
-	const double pi = 3.14159265358979323846264338327950288419716939937510;
-
-	float x, y, z;
+// Resolves the references between equations, giving each the source it compiles.
+void resolve_equations() {
+	std::vector<std::pair<std::string, std::string>> texts;
+	for (const Equation& equation : equations)
+		texts.emplace_back(equation.name, equation.buf);
+	equation_graph.build(texts, function_library);
+	for (size_t i = 0; i < equations.size(); i++) {
+		equations[i].source = equation_graph.node(i).source;
+		equations[i].reference_error = equation_graph.node(i).error;
+	}
+}
 
-	symbol_table.add_constant("e", e);
+// x, y and z followed by the parameters of the equation, in the order they are bound.
+std::vector<std::string> equation_variables(const Equation& equation) {
+	std::vector<std::string> variables = { "x", "y", "z" };
+	for (const auto& parameter : equation.parameters)
+		variables.push_back(parameter.name);
+	return variables;
+}
 
-	symbol_table.add_pi();
+std::vector<double> parameter_values(const Equation& equation) {
+	std::vector<double> values;
+	for (const auto& parameter : equation.parameters)
+		values.push_back(parameter.value);
+	return values;
+}
 
-	symbol_table.add_variable("x", x);
-	symbol_table.add_variable("y", y);
-	symbol_table.add_variable("z", z);
+bool is_animated(const Equation& equation) {
+	return std::any_of(equation.parameters.begin(), equation.parameters.end(), [](const Parameter& p) { return p.animated; });
+}
 
-	expr.register_symbol_table(symbol_table);
-	parser.compile(equation.buf, expr);
+// Makes a parameter of every free symbol in the equation, keeping the sliders of those that remain.
+void sync_parameters(Equation& equation) {
+	std::vector<Parameter> parameters;
+	for (const auto& name : function_library.free_symbols(equation.source, { "x", "y", "z" })) {
+		auto existing = std::find_if(equation.parameters.begin(), equation.parameters.end(), [&](const Parameter& p) { return p.name == name; });
+		if (existing != equation.parameters.end()) {
+			parameters.push_back(*existing);
+		}
+		else {
+			parameters.emplace_back();
+			parameters.back().name = name;
+			if (name == time_parameter) {
+				parameters.back().animated = true;
+				parameters.back().value = static_cast<float>(glfwGetTime());
+			}
+		}
+	}
+	equation.parameters = parameters;
+}
 
-	symbol_table.get_variable("x")->ref() = x;
-	symbol_table.get_variable("y")->ref() = y;
-	symbol_table.get_variable("z")->ref() = z;
+template <typename T>
+std::shared_ptr<PartialEvaluation<T>>& partial_evaluation(Equation& equation) {
+	if constexpr (std::is_same<T, float>::value)
+		return equation.float_partial;
+	else
+		return equation.double_partial;
+}
 
+// Sample positions of one equation and the heights computed for them. 2D equations have no y
+// samples and one height per x sample.
+template <typename T>
+struct SurfaceGrid {
+	AxisLattice<T> x_lattice;
+	AxisLattice<T> y_lattice;
+	std::vector<T> x_samples;
+	std::vector<T> y_samples;
+	std::vector<T> heights;
+};
+
+// Clears what the previous generation recorded about an equation.
+template <typename T>
+void begin_generation(Equation& equation, const CompiledExpression<T>& compiled) {
 	min_height = FLT_MAX;
 	max_height = -FLT_MAX;
+	equation.library_key = function_library.dependency_key(equation.source);
+	equation.parsed_operations = compiled.parsed_operations;
+	equation.simplified_operations = compiled.simplified_operations;
+	equation.clipped_samples = 0;
+	std::fill(std::begin(equation.domain_errors), std::end(equation.domain_errors), 0);
+}
+
+// Places the samples of each axis: evenly spaced base samples, refined wherever the equation is
+// steep or a pole falls between two of them. With a previous generation the base samples stay on
+// its lattices, so that the two grids share samples.
+template <typename T>
+void sample_axes(Equation& equation, CompiledExpression<T>& compiled, SurfaceGrid<T>& grid, const GridCache<T>* previous = nullptr) {
+	T& x = compiled.variable(0);
+	T& y = compiled.variable(1);
 
+	const Program* program = compiled.program.get();
 	double epsilon = 1e-6;
 
-	auto adaptive_samples = [&](auto&& func, float min, float max) {
-		std::vector<float> samples;
-		std::function<void(float, float, float, float, int)> subdivide = [&](float x0, float x1, float y0, float y1, int depth) {
+	// func returns the value at a sample and the slope along the sampled axis. A NaN slope means no
+	// derivative is available, and the slope is estimated from the midpoint instead. bound gives the
+	// range of the equation between two samples, which exposes poles that fall between them.
+	typedef std::pair<T, T> Sample;
+	auto adaptive_samples = [&](auto&& func, auto&& bound, const AxisLattice<T>& lattice) {
+		std::vector<T> samples;
+		std::function<void(T, T, Sample, Sample, int)> subdivide = [&](T x0, T x1, Sample f0, Sample f1, int depth) {
 			if (depth >= max_depth) {
 				samples.push_back(x0);
 				return;
 			}
 
-			const float x_mid = (x0 + x1) * 0.5f;
-			const float y_mid = func(x_mid);
+			const T x_mid = (x0 + x1) * T(0.5);
+			const bool exact = !std::isnan(f0.second) && !std::isnan(f1.second);
+
+			Sample f_mid;
+			T steepest;
+			if (exact) {
+				const T secant = std::abs((f1.first - f0.first) / (x1 - x0 + epsilon));
+				steepest = std::max({ std::abs(f0.second), std::abs(f1.second), secant });
+			}
+			else {
+				f_mid = func(x_mid);
+				const T dy_left = std::abs((f_mid.first - f0.first) / (x_mid - x0 + epsilon));
+				const T dy_right = std::abs((f1.first - f_mid.first) / (x1 - x_mid + epsilon));
+				steepest = std::max(dy_left, dy_right);
+			}
 
-			const float dy_left = std::abs((y_mid - y0) / (x_mid - x0 + epsilon));
-			const float dy_right = std::abs((y1 - y_mid) / (x1 - x_mid + epsilon));
+			bool pole = false;
+			if (program && steepest <= derivative_threshold && !bounded(bound(x0, x1)))
+				pole = bounded(bound(x0, x_mid)) || bounded(bound(x_mid, x1));
 
-			if (dy_left > derivative_threshold || dy_right > derivative_threshold) {
-				subdivide(x0, x_mid, y0, y_mid, depth + 1);
-				subdivide(x_mid, x1, y_mid, y1, depth + 1);
+			if (steepest > derivative_threshold || pole) {
+				if (exact)
+					f_mid = func(x_mid);
+				subdivide(x0, x_mid, f0, f_mid, depth + 1);
+				subdivide(x_mid, x1, f_mid, f1, depth + 1);
 			}
 			else {
 				samples.push_back(x0);
 			}
 			};
-		std::vector<float> base_x;
-		for (int i = 0; i < equation.sample_size; i++) {
-			base_x.push_back(min + (max - min) * (i / float(equation.sample_size - 1)));
+		std::vector<T> base_x;
+		for (size_t i = 0; i < lattice.count; i++) {
+			base_x.push_back(lattice.sample(i));
+		}
+
+		std::vector<Sample> base_f;
+		for (T t : base_x) {
+			base_f.push_back(func(t));
 		}
 
 		for (size_t i = 0; i < base_x.size() - 1; i++) {
-			const float x0 = base_x[i];
-			const float x1 = base_x[i + 1];
-			subdivide(x0, x1, func(x0), func(x1), 0);
+			subdivide(base_x[i], base_x[i + 1], base_f[i], base_f[i + 1], 0);
 		}
 
-		samples.push_back(max);
+		samples.push_back(base_x.back());
 		std::sort(samples.begin(), samples.end());
 		return samples;
 	};
 
-	auto safe_eval = [&](float x_val, float y_val = 0) {
-		try {
-			x = x_val;
-			y = equation.is_3d ? y_val : 0;
-			return expr.value();
+	auto safe_eval_dual = [&](T x_val, T y_val) {
+		x = x_val;
+		y = equation.is_3d ? y_val : 0;
+		return compiled.evaluate_dual();
+	};
+
+	auto slope_x = [&](T x) {
+		const Dual<T> d = safe_eval_dual(x, equation.min_y);
+		return Sample(d.value, d.dx);
+	};
+
+	auto slope_y = [&](T y) {
+		const Dual<T> d = safe_eval_dual(equation.min_x, y);
+		return Sample(d.value, d.dy);
+	};
+
+	// the x bound spans every y of the surface, so columns crossing a pole anywhere get refined
+	auto bound_x = [&](T x0, T x1) {
+		const Interval box[] = {
+			make_interval(x0, x1),
+			equation.is_3d ? make_interval(equation.min_y, equation.max_y) : make_interval(0.0, 0.0),
+			make_interval(0.0, 0.0),
+		};
+		return evaluate_interval(*program, box);
+	};
+
+	auto bound_y = [&](T y0, T y1) {
+		const Interval box[] = { make_interval(equation.min_x, equation.max_x), make_interval(y0, y1), make_interval(0.0, 0.0) };
+		return evaluate_interval(*program, box);
+	};
+
+	grid.x_lattice = place_lattice<T>(equation.min_x, equation.max_x, equation.sample_size, previous ? &previous->x_lattice : nullptr);
+	grid.x_samples = adaptive_samples(slope_x, bound_x, grid.x_lattice);
+	grid.y_samples.clear();
+	if (equation.is_3d) {
+		grid.y_lattice = place_lattice<T>(equation.min_y, equation.max_y, equation.sample_size, previous ? &previous->y_lattice : nullptr);
+		grid.y_samples = adaptive_samples(slope_y, bound_y, grid.y_lattice);
+	}
+}
+
+// Runs a program over the columns [begin, end) of an equation's grid. extra holds arrays laid out
+// like the heights that are passed as the inputs after x, y and z, and outs[k] receives result k.
+template <typename T>
+void sweep_columns(const Program& program, const std::vector<T>& x_samples, const std::vector<T>& y_samples, const Equation& equation,
+	const std::vector<const T*>& extra, const std::vector<T*>& outs, size_t begin, size_t end) {
+	const bool is_3d = equation.is_3d;
+	const size_t rows = is_3d ? y_samples.size() : 1;
+	std::vector<T> zeros(std::max(end - begin, rows), T(0));
+
+	if (!is_3d) {
+		std::vector<const T*> inputs = { x_samples.data() + begin, zeros.data(), zeros.data() };
+		for (const T* values : extra)
+			inputs.push_back(values + begin);
+		std::vector<T*> range_outs;
+		for (T* out : outs)
+			range_outs.push_back(out + begin);
+		evaluate_batch_outputs(program, inputs.data(), range_outs.data(), end - begin, equation.accuracy);
+		return;
+	}
+
+	const size_t tiles_x = (end - begin + tile_size - 1) / tile_size;
+	thread_pool.parallel_for(tiles_x, [&](size_t tile, size_t /* worker */) {
+		std::vector<T> column_x(rows);
+		std::vector<const T*> inputs = { column_x.data(), y_samples.data(), zeros.data() };
+		inputs.resize(first_parameter + extra.size());
+		std::vector<T*> column_outs(outs.size());
+		for (size_t i = begin + tile * tile_size; i < std::min(end, begin + (tile + 1) * tile_size); i++) {
+			std::fill(column_x.begin(), column_x.end(), x_samples[i]);
+			for (size_t k = 0; k < extra.size(); k++)
+				inputs[first_parameter + k] = extra[k] + i * rows;
+			for (size_t k = 0; k < outs.size(); k++)
+				column_outs[k] = outs[k] + i * rows;
+			evaluate_batch_outputs(program, inputs.data(), column_outs.data(), rows, equation.accuracy);
+		}
+	});
+}
+
+template <typename T>
+void sweep_grid(const Program& program, const SurfaceGrid<T>& grid, const Equation& equation, const std::vector<const T*>& extra, const std::vector<T*>& outs) {
+	sweep_columns(program, grid.x_samples, grid.y_samples, equation, extra, outs, 0, grid.x_samples.size());
+}
+
+// Caches the parameter-independent subtrees of the equation at every sample of the grid. Equations
+// with nothing to cache keep only the samples, so that parameter changes can reuse them.
+template <typename T>
+void cache_partial(Equation& equation, const CompiledExpression<T>& compiled, const SurfaceGrid<T>& grid) {
+	const size_t samples = grid.x_samples.size() * (equation.is_3d ? grid.y_samples.size() : 1);
+
+	auto partial = std::make_shared<PartialEvaluation<T>>();
+	partial->source = compiled.parametric_program;
+	partial->x_samples = grid.x_samples;
+	partial->y_samples = grid.y_samples;
+	if (compiled.base_program) {
+		partial->cached.assign(compiled.base_program->results.size(), std::vector<T>(samples));
+		std::vector<T*> outs;
+		for (auto& values : partial->cached)
+			outs.push_back(values.data());
+		sweep_grid(*compiled.base_program, grid, equation, {}, outs);
+	}
+	partial_evaluation<T>(equation) = partial;
+}
+
+// The program that finishes a sample from its cached subtrees, with the parameters' current values.
+template <typename T>
+Program bind_residual(const Equation& equation, const CompiledExpression<T>& compiled) {
+	const Program& residual = compiled.residual_program ? *compiled.residual_program : *compiled.parametric_program;
+	return bind_inputs(residual, first_parameter, parameter_values(equation));
+}
+
+template <typename T>
+std::vector<const T*> cached_inputs(const PartialEvaluation<T>& partial) {
+	std::vector<const T*> cached;
+	for (const auto& values : partial.cached)
+		cached.push_back(values.data());
+	return cached;
+}
+
+// Fills grid.heights from the cached subtrees with the parameters' current values.
+template <typename T>
+void evaluate_residual(Equation& equation, const CompiledExpression<T>& compiled, const PartialEvaluation<T>& partial, SurfaceGrid<T>& grid) {
+	grid.heights.assign(grid.x_samples.size() * (equation.is_3d ? grid.y_samples.size() : 1), T(0));
+	sweep_grid(bind_residual(equation, compiled), grid, equation, cached_inputs(partial), { grid.heights.data() });
+}
+
+// Fills grid.heights through the cheapest path the compiled expression supports.
+template <typename T>
+void evaluate_heights(Equation& equation, ExpressionCache<T>& cache, const std::shared_ptr<CompiledExpression<T>>& compiled, SurfaceGrid<T>& grid) {
+	T& x = compiled->variable(0);
+	T& y = compiled->variable(1);
+
+	const Program* program = compiled->program.get();
+	const std::vector<T>& x_samples = grid.x_samples;
+	const std::vector<T>& y_samples = grid.y_samples;
+	std::vector<T>& heights = grid.heights;
+	double epsilon = 1e-6;
+
+	// Domain errors come back as NaN or infinity rather than exceptions, so nothing here needs a
+	// try block. record_sample() works out afterwards why a sample is missing.
+	auto safe_eval = [&](T x_val, T y_val = 0) {
+		x = x_val;
+		y = equation.is_3d ? y_val : 0;
+		return compiled->evaluate();
+	};
+
+	if (equation.is_3d) {
+		const size_t cols = x_samples.size();
+		const size_t rows = y_samples.size();
+		const size_t tiles_x = (cols + tile_size - 1) / tile_size;
+		const size_t tiles_y = (rows + tile_size - 1) / tile_size;
+		const size_t tile_count = tiles_x * tiles_y;
+		const size_t worker_count = tile_count > 1 ? thread_pool.size() : 1;
+
+		// library functions share their exprtk state, so those expressions evaluate on this thread
+		const bool serial = !program && compiled->library;
+
+		std::vector<std::shared_ptr<CompiledExpression<T>>> worker_exprs(worker_count);
+		worker_exprs[0] = compiled;
+		for (size_t i = 1; i < worker_count && !program && !serial; i++) {
+			worker_exprs[i] = cache.get(equation.source, equation_variables(equation), i);
+			worker_exprs[i]->set_parameters(parameter_values(equation));
+		}
+
+		heights.assign(cols * rows, T(0));
+
+		auto fill_box = [&](size_t x_begin, size_t x_end, size_t y_begin, size_t y_end, T value) {
+			for (size_t i = x_begin; i < x_end; i++)
+				std::fill(heights.begin() + i * rows + y_begin, heights.begin() + i * rows + y_end, value);
+		};
+
+		// Bounds the samples [x_begin, x_end) x [y_begin, y_end) before evaluating them. Boxes that are
+		// provably outside the z range are dropped and provably flat boxes are filled with their value.
+		// Undecided boxes are split until they are small enough to evaluate directly. Interval bounds
+		// are only as tight as a float, so in double precision, where boxes can be far narrower than a
+		// float ulp, no box is ever taken to be flat.
+		std::function<void(size_t, size_t, size_t, size_t)> evaluate_box = [&](size_t x_begin, size_t x_end, size_t y_begin, size_t y_end) {
+			const Interval box[] = {
+				make_interval(x_samples[x_begin], x_samples[x_end - 1]),
+				make_interval(y_samples[y_begin], y_samples[y_end - 1]),
+				make_interval(0.0, 0.0),
+			};
+			const Interval range = evaluate_interval(*program, box);
+
+			if (!range.nan && (range.hi < equation.min_z || range.lo > equation.max_z)) {
+				const T outside = range.hi < equation.min_z ? std::nextafter(T(equation.min_z), -std::numeric_limits<T>::max()) : std::nextafter(T(equation.max_z), std::numeric_limits<T>::max());
+				fill_box(x_begin, x_end, y_begin, y_end, outside);
+				return;
+			}
+			if (std::is_same<T, float>::value && !range.nan && range.hi - range.lo <= epsilon * std::max(1.0, std::abs(range.lo))) {
+				fill_box(x_begin, x_end, y_begin, y_end, static_cast<T>((range.lo + range.hi) * 0.5));
+				return;
+			}
+
+			if (x_end - x_begin > leaf_size || y_end - y_begin > leaf_size) {
+				const size_t x_mid = x_end - x_begin > leaf_size ? (x_begin + x_end) / 2 : x_end;
+				const size_t y_mid = y_end - y_begin > leaf_size ? (y_begin + y_end) / 2 : y_end;
+				evaluate_box(x_begin, x_mid, y_begin, y_mid);
+				if (y_mid < y_end) evaluate_box(x_begin, x_mid, y_mid, y_end);
+				if (x_mid < x_end) evaluate_box(x_mid, x_end, y_begin, y_mid);
+				if (x_mid < x_end && y_mid < y_end) evaluate_box(x_mid, x_end, y_mid, y_end);
+				return;
+			}
+
+			T column_x[leaf_size];
+			T column_z[leaf_size] = {};
+			const T* inputs[] = { column_x, y_samples.data() + y_begin, column_z };
+			for (size_t i = x_begin; i < x_end; i++) {
+				std::fill(column_x, column_x + (y_end - y_begin), x_samples[i]);
+				evaluate_batch(*program, inputs, heights.data() + i * rows + y_begin, y_end - y_begin, equation.accuracy);
+			}
+		};
+
+		if (compiled->separation != Separation::None) {
+			std::vector<T> fx(cols);
+			std::vector<T> gy(rows);
+			std::vector<T> zeros(std::max(cols, rows), T(0));
+			const T* x_inputs[] = { x_samples.data(), zeros.data(), zeros.data() };
+			const T* y_inputs[] = { zeros.data(), y_samples.data(), zeros.data() };
+			evaluate_batch(*compiled->x_program, x_inputs, fx.data(), cols, equation.accuracy);
+			evaluate_batch(*compiled->y_program, y_inputs, gy.data(), rows, equation.accuracy);
+			combine_outer(compiled->separation, fx.data(), cols, gy.data(), rows, heights.data());
+		}
+		else if (compiled->polynomial) {
+			const Polynomial& polynomial = *compiled->polynomial;
+			const SampleAxis y_axis = make_axis(y_samples.data(), rows);
+			thread_pool.parallel_for(tiles_x, [&](size_t tile, size_t /* worker */) {
+				std::vector<double> row;
+				for (size_t i = tile * tile_size; i < std::min(cols, (tile + 1) * tile_size); i++) {
+					polynomial.row(x_samples[i], row);
+					evaluate_polynomial_line(row, y_axis, heights.data() + i * rows);
+				}
+			});
+		}
+		else {
+			auto evaluate_tile = [&](size_t tile, size_t worker) {
+				const size_t x_begin = (tile / tiles_y) * tile_size;
+				const size_t y_begin = (tile % tiles_y) * tile_size;
+				const size_t x_end = std::min(x_begin + tile_size, cols);
+				const size_t y_end = std::min(y_begin + tile_size, rows);
+
+				if (program) {
+					evaluate_box(x_begin, x_end, y_begin, y_end);
+					return;
+				}
+
+				CompiledExpression<T>& worker_expr = *worker_exprs[worker];
+				T& wx = worker_expr.variable(0);
+				T& wy = worker_expr.variable(1);
+
+				for (size_t i = x_begin; i < x_end; i++) {
+					for (size_t j = y_begin; j < y_end; j++) {
+						wx = x_samples[i];
+						wy = y_samples[j];
+						heights[i * rows + j] = worker_expr.evaluate();
+					}
+				}
+			};
+
+			if (serial) {
+				for (size_t tile = 0; tile < tile_count; tile++)
+					evaluate_tile(tile, 0);
+			}
+			else {
+				thread_pool.parallel_for(tile_count, evaluate_tile);
+			}
+		}
+
+	}
+	else {
+		heights.assign(x_samples.size(), T(0));
+		if (compiled->polynomial) {
+			std::vector<double> column;
+			compiled->polynomial->column(0.0, column);
+			evaluate_polynomial_line(column, make_axis(x_samples.data(), x_samples.size()), heights.data());
+		}
+		else if (compiled->program) {
+			std::vector<T> zeros(x_samples.size(), T(0));
+			const T* inputs[] = { x_samples.data(), zeros.data(), zeros.data() };
+			evaluate_batch(*compiled->program, inputs, heights.data(), heights.size(), equation.accuracy);
+		}
+		else {
+			for (size_t i = 0; i < x_samples.size(); i++) {
+				heights[i] = safe_eval(x_samples[i]);
+			}
+		}
+
+	}
+}
+
+template <typename T>
+std::shared_ptr<GridCache<T>>& grid_cache(Equation& equation) {
+	if constexpr (std::is_same<T, float>::value)
+		return equation.float_grid;
+	else
+		return equation.double_grid;
+}
+
+// The equation's last generation, when its heights still hold for the compiled expression and the
+// equation's settings. Only equations with a program and without parameters keep one.
+template <typename T>
+std::shared_ptr<GridCache<T>> reusable_grid(Equation& equation, const CompiledExpression<T>& compiled) {
+	const std::shared_ptr<GridCache<T>> cached = grid_cache<T>(equation);
+	if (!cached || !compiled.program || compiled.parametric_program || cached->program != compiled.program ||
+		cached->accuracy != equation.accuracy || cached->is_3d != equation.is_3d || cached->sample_size != equation.sample_size ||
+		cached->min_z != equation.min_z || cached->max_z != equation.max_z)
+		return nullptr;
+	return cached;
+}
+
+// Keeps the grid of a generation for the next one to reuse.
+template <typename T>
+void store_grid(Equation& equation, const CompiledExpression<T>& compiled, SurfaceGrid<T>&& grid) {
+	std::shared_ptr<GridCache<T>>& cached = grid_cache<T>(equation);
+	if (!compiled.program || compiled.parametric_program) {
+		cached.reset();
+		return;
+	}
+	cached = std::make_shared<GridCache<T>>();
+	cached->program = compiled.program;
+	cached->accuracy = equation.accuracy;
+	cached->is_3d = equation.is_3d;
+	cached->sample_size = equation.sample_size;
+	cached->min_z = equation.min_z;
+	cached->max_z = equation.max_z;
+	cached->x_lattice = grid.x_lattice;
+	cached->y_lattice = grid.y_lattice;
+	cached->x_samples = std::move(grid.x_samples);
+	cached->y_samples = std::move(grid.y_samples);
+	cached->heights = std::move(grid.heights);
+}
+
+// Fills grid.heights with the heights of the previous generation wherever it has the sample, and
+// evaluates only the samples it lacks, so panning costs as much as the newly exposed strips. Returns
+// false when less than half of the grid can be reused; a full evaluation is cheaper then.
+template <typename T>
+bool reuse_heights(const Equation& equation, const CompiledExpression<T>& compiled, const GridCache<T>& previous, SurfaceGrid<T>& grid) {
+	const std::vector<ptrdiff_t> old_columns = match_samples(previous.x_samples, grid.x_samples);
+	const std::vector<ptrdiff_t> old_rows = equation.is_3d ? match_samples(previous.y_samples, grid.y_samples) : std::vector<ptrdiff_t>{ 0 };
+	const size_t cols = grid.x_samples.size();
+	const size_t rows = old_rows.size();
+	const size_t previous_rows = equation.is_3d ? previous.y_samples.size() : 1;
+
+	const size_t shared_columns = std::count_if(old_columns.begin(), old_columns.end(), [](ptrdiff_t i) { return i >= 0; });
+	const size_t shared_rows = std::count_if(old_rows.begin(), old_rows.end(), [](ptrdiff_t j) { return j >= 0; });
+	if (shared_columns * shared_rows * 2 < cols * rows)
+		return false;
+
+	grid.heights.assign(cols * rows, T(0));
+	std::vector<T> missing_x, missing_y;
+	std::vector<size_t> missing;
+	for (size_t i = 0; i < cols; i++) {
+		for (size_t j = 0; j < rows; j++) {
+			if (old_columns[i] >= 0 && old_rows[j] >= 0) {
+				grid.heights[i * rows + j] = previous.heights[old_columns[i] * previous_rows + old_rows[j]];
+				continue;
+			}
+			missing_x.push_back(grid.x_samples[i]);
+			missing_y.push_back(equation.is_3d ? grid.y_samples[j] : T(0));
+			missing.push_back(i * rows + j);
 		}
-		catch (...) {
-			return NAN;
+	}
+
+	const size_t chunk = 4096;
+	thread_pool.parallel_for((missing.size() + chunk - 1) / chunk, [&](size_t task, size_t /* worker */) {
+		const size_t begin = task * chunk;
+		const size_t count = std::min(chunk, missing.size() - begin);
+		std::vector<T> zeros(count, T(0)), heights(count);
+		const T* inputs[] = { missing_x.data() + begin, missing_y.data() + begin, zeros.data() };
+		evaluate_batch(*compiled.program, inputs, heights.data(), count, equation.accuracy);
+		for (size_t k = 0; k < count; k++)
+			grid.heights[missing[begin + k]] = heights[k];
+	});
+	return true;
+}
+
+// Turns the heights into vertices. Only here do values narrow to float.
+template <typename T>
+void emit_vertices(Equation& equation, const CompiledExpression<T>& compiled, const SurfaceGrid<T>& grid) {
+	const Program* program = compiled.program.get();
+	const std::vector<T>& x_samples = grid.x_samples;
+	const std::vector<T>& y_samples = grid.y_samples;
+	const std::vector<T>& heights = grid.heights;
+
+	// Returns whether a sample should be drawn, and otherwise counts why it is missing.
+	auto record_sample = [&](T x_val, T y_val, T z) {
+		if (std::isfinite(z)) {
+			if (z >= equation.min_z && z <= equation.max_z)
+				return true;
+			equation.clipped_samples++;
+			return false;
+		}
+
+		DomainError error = DomainError::Unknown;
+		if (program) {
+			const T inputs[] = { x_val, y_val, T(0) };
+			error = diagnose(*program, inputs);
 		}
+		equation.domain_errors[static_cast<size_t>(error)]++;
+		return false;
 	};
 
 	if (equation.is_3d) {
-		auto x_samples = adaptive_samples([&](float x) { return safe_eval(x, equation.min_y); }, equation.min_x, equation.max_x);
-		auto y_samples = adaptive_samples([&](float y) { return safe_eval(equation.min_x, y); }, equation.min_y, equation.max_y);
-
-		for (float x : x_samples) {
-			for (float y : y_samples) {
-				const float z = safe_eval(x, y);
-				if (!std::isnan(z)) {
-					equation.points_vec_equation.emplace_back(x, z, y);
+		const size_t cols = x_samples.size();
+		const size_t rows = y_samples.size();
+		// the vertex each sample became, so the mesh only joins samples that were drawn
+		const unsigned int not_drawn = std::numeric_limits<unsigned int>::max();
+		std::vector<unsigned int> vertices(equation.is_mesh ? cols * rows : 0, not_drawn);
+
+		for (size_t i = 0; i < cols; i++) {
+			const T x = x_samples[i];
+			for (size_t j = 0; j < rows; j++) {
+				const T y = y_samples[j];
+				const T z = heights[i * rows + j];
+				if (record_sample(x, y, z)) {
+					if (equation.is_mesh)
+						vertices[i * rows + j] = static_cast<unsigned int>(equation.points_vec_equation.size() / 2);
+					equation.points_vec_equation.emplace_back(static_cast<float>(x), static_cast<float>(z), static_cast<float>(y));
 					equation.points_vec_equation.emplace_back(glm::make_vec3(equation.data));
-					min_height = std::min(min_height, z);
-					max_height = std::max(max_height, z);
+					min_height = std::min(min_height, static_cast<float>(z));
+					max_height = std::max(max_height, static_cast<float>(z));
 				}
 			}
 		}
 
 		if (equation.is_mesh) {
-			const int cols = x_samples.size();
-			const int rows = y_samples.size();
-
-			for (int y = 0; y < rows - 1; y++) {
-				for (int x = 0; x < cols - 1; x++) {
-					const int i0 = y * cols + x;
-					const int i1 = y * cols + (x + 1);
-					const int i2 = (y + 1) * cols + x;
-					const int i3 = (y + 1) * cols + (x + 1);
-
-					if (std::isnan(equation.points_vec_equation[i0].y) ||
-						std::isnan(equation.points_vec_equation[i1].y) ||
-						std::isnan(equation.points_vec_equation[i2].y) ||
-						std::isnan(equation.points_vec_equation[i3].y))
+			for (size_t i = 0; i + 1 < cols; i++) {
+				for (size_t j = 0; j + 1 < rows; j++) {
+					const unsigned int i0 = vertices[i * rows + j];
+					const unsigned int i1 = vertices[(i + 1) * rows + j];
+					const unsigned int i2 = vertices[i * rows + j + 1];
+					const unsigned int i3 = vertices[(i + 1) * rows + j + 1];
+
+					if (i0 == not_drawn || i1 == not_drawn || i2 == not_drawn || i3 == not_drawn)
 						continue;
-					equation.indices.insert(equation.indices.end(), {
-						static_cast<unsigned int>(i0),
-						static_cast<unsigned int>(i1),
-						static_cast<unsigned int>(i2),
-						static_cast<unsigned int>(i1),
-						static_cast<unsigned int>(i3),
-						static_cast<unsigned int>(i2),
-						});
+					equation.indices.insert(equation.indices.end(), { i0, i1, i2, i1, i3, i2 });
 				}
 			}
 		}
 	}
 	else {
-		auto x_samples = adaptive_samples([&](float x) { return safe_eval(x, equation.min_y); }, equation.min_x, equation.max_x);
-
-		for (float x : x_samples) {
-			const float y = safe_eval(x);
-			if (!std::isnan(y)) {
-				equation.points_vec_equation.emplace_back(x, y, 0);
+		for (size_t i = 0; i < x_samples.size(); i++) {
+			const T x = x_samples[i];
+			const T y = heights[i];
+			if (record_sample(x, T(0), y)) {
+				equation.points_vec_equation.emplace_back(static_cast<float>(x), static_cast<float>(y), 0.0f);
 				equation.points_vec_equation.emplace_back(glm::make_vec3(equation.data));
-				min_height = std::min(min_height, y);
-				max_height = std::max(max_height, y);
+				min_height = std::min(min_height, static_cast<float>(y));
+				max_height = std::max(max_height, static_cast<float>(y));
 			}
 		}
 	}
 }
 
+// Everything the vertices of a generation depend on, as text. The colour is left out and applied
+// when a mesh is restored. Empty when the generation should not be cached: equations that animate
+// would store a mesh every frame that nothing reads again.
+template <typename T>
+std::string mesh_cache_key(const Equation& equation, const GridCache<T>* previous) {
+	if (is_animated(equation))
+		return std::string();
+
+	std::string key = "precision " + std::to_string(sizeof(T)) + "\n" + equation.source + "\n";
+	auto number = [&](const char* name, double value) {
+		char text[64];
+		std::snprintf(text, sizeof(text), "%s %a\n", name, value);
+		key += text;
+	};
+	// library symbols are versioned per run, so the whole library stands in for them
+	if (!function_library.dependency_key(equation.source).empty())
+		key += "library " + function_library.source() + "\n";
+	for (const Parameter& parameter : equation.parameters)
+		number(parameter.name.c_str(), parameter.value);
+	number("is_3d", equation.is_3d);
+	number("is_mesh", equation.is_mesh);
+	number("sample_size", equation.sample_size);
+	number("min_x", equation.min_x);
+	number("max_x", equation.max_x);
+	number("min_y", equation.min_y);
+	number("max_y", equation.max_y);
+	number("min_z", equation.min_z);
+	number("max_z", equation.max_z);
+	number("accuracy", static_cast<int>(equation.accuracy));
+	number("max_depth", max_depth);
+	number("derivative_threshold", derivative_threshold);
+	// a previous generation can keep the base samples on its lattice, so the lattice is part of the key
+	auto lattice = [&](const char* axis, float min, float max, const AxisLattice<T>* kept) {
+		const AxisLattice<T> placed = place_lattice<T>(min, max, equation.sample_size, kept);
+		key += axis;
+		number(" origin", placed.origin);
+		number(" spacing", placed.spacing);
+		number(" first", static_cast<double>(placed.first));
+	};
+	lattice("x", equation.min_x, equation.max_x, previous ? &previous->x_lattice : nullptr);
+	if (equation.is_3d)
+		lattice("y", equation.min_y, equation.max_y, previous ? &previous->y_lattice : nullptr);
+	return key;
+}
+
+// Replaces the equation's vertices with a cached mesh, from memory or else from disk. Returns false
+// on a miss.
+bool restore_mesh(Equation& equation, const std::string& key) {
+	memory_cache.set_budget(static_cast<size_t>(std::max(memory_cache_megabytes, 0)) << 20);
+	std::shared_ptr<const CachedMesh> mesh = memory_cache.find(key);
+	if (!mesh && use_disk_cache) {
+		auto loaded = std::make_shared<CachedMesh>();
+		if (disk_cache.load(key, *loaded)) {
+			memory_cache.insert(key, loaded);
+			mesh = loaded;
+		}
+	}
+	if (!mesh)
+		return false;
+
+	equation.points_vec_equation = mesh->vertices;
+	equation.indices = mesh->indices;
+	equation.clipped_samples = mesh->clipped_samples;
+	std::copy(std::begin(mesh->domain_errors), std::end(mesh->domain_errors), std::begin(equation.domain_errors));
+	for (size_t k = 0; k + 1 < equation.points_vec_equation.size(); k += 2) {
+		equation.points_vec_equation[k + 1] = glm::make_vec3(equation.data);
+		min_height = std::min(min_height, equation.points_vec_equation[k].y);
+		max_height = std::max(max_height, equation.points_vec_equation[k].y);
+	}
+	return true;
+}
+
+void save_mesh(const Equation& equation, const std::string& key) {
+	auto mesh = std::make_shared<CachedMesh>();
+	mesh->vertices = equation.points_vec_equation;
+	mesh->indices = equation.indices;
+	mesh->clipped_samples = equation.clipped_samples;
+	std::copy(std::begin(equation.domain_errors), std::end(equation.domain_errors), std::begin(mesh->domain_errors));
+	memory_cache.set_budget(static_cast<size_t>(std::max(memory_cache_megabytes, 0)) << 20);
+	memory_cache.insert(key, mesh);
+	if (use_disk_cache) {
+		disk_cache.set_capacity(static_cast<uint64_t>(std::max(disk_cache_megabytes, 0)) << 20);
+		disk_cache.store(key, *mesh);
+	}
+}
+
+// Samples one equation with every evaluation done in T.
+template <typename T>
+void generate_samples(Equation& equation, ExpressionCache<T>& cache) {
+	sync_parameters(equation);
+	std::shared_ptr<CompiledExpression<T>> compiled = cache.get(equation.source, equation_variables(equation));
+	compiled->set_parameters(parameter_values(equation));
+
+	begin_generation(equation, *compiled);
+	partial_evaluation<T>(equation).reset();
+	if (!compiled->valid)
+		return;
+	const std::shared_ptr<GridCache<T>> previous = reusable_grid(equation, *compiled);
+	const std::string key = mesh_cache_key<T>(equation, previous.get());
+	if (!key.empty() && restore_mesh(equation, key))
+		return;
+
+	SurfaceGrid<T> grid;
+	sample_axes(equation, *compiled, grid, previous.get());
+	if (compiled->parametric_program) {
+		cache_partial(equation, *compiled, grid);
+		evaluate_residual(equation, *compiled, *partial_evaluation<T>(equation), grid);
+	}
+	else if (!previous || !reuse_heights(equation, *compiled, *previous, grid)) {
+		evaluate_heights(equation, cache, compiled, grid);
+	}
+	emit_vertices(equation, *compiled, grid);
+	if (!key.empty())
+		save_mesh(equation, key);
+	store_grid(equation, *compiled, std::move(grid));
+}
+
+// Re-evaluates an equation after a slider moved, on the samples and cached subtrees of its last
+// generation. Without a cache for the current compile the equation is generated from scratch.
+template <typename T>
+void update_parameters(Equation& equation, ExpressionCache<T>& cache) {
+	std::shared_ptr<CompiledExpression<T>> compiled = cache.get(equation.source, equation_variables(equation));
+	const std::shared_ptr<PartialEvaluation<T>> partial = partial_evaluation<T>(equation);
+	if (!compiled->valid || !partial || partial->source != compiled->parametric_program) {
+		generate_samples(equation, cache);
+		return;
+	}
+
+	compiled->set_parameters(parameter_values(equation));
+	begin_generation(equation, *compiled);
+	partial->pass.reset();
+
+	SurfaceGrid<T> grid;
+	grid.x_samples = partial->x_samples;
+	grid.y_samples = partial->y_samples;
+	evaluate_residual(equation, *compiled, *partial, grid);
+	emit_vertices(equation, *compiled, grid);
+}
+
+void release_gpu_surface(Equation& equation) {
+	if (!equation.gpu)
+		return;
+	GpuSurface& surface = *equation.gpu;
+	if (surface.vertex_array != 0) {
+		glDeleteVertexArrays(1, &surface.vertex_array);
+		glDeleteBuffers(1, &surface.grid_buffer);
+	}
+	glDeleteProgram(surface.shader->ID);
+	equation.gpu.reset();
+}
+
+// Fills the grid a GPU surface is drawn on: resolution vertices along each axis of [0, 1], or one
+// row of them for 2D equations.
+void upload_gpu_grid(GpuSurface& surface, int resolution, bool is_3d) {
+	const int rows = is_3d ? resolution : 1;
+	std::vector<float> grid;
+	grid.reserve(static_cast<size_t>(resolution) * rows * 2);
+	for (int i = 0; i < resolution; i++) {
+		for (int j = 0; j < rows; j++) {
+			grid.push_back(static_cast<float>(i) / (resolution - 1));
+			grid.push_back(rows > 1 ? static_cast<float>(j) / (rows - 1) : 0.0f);
+		}
+	}
+
+	if (surface.vertex_array == 0) {
+		glGenVertexArrays(1, &surface.vertex_array);
+		glGenBuffers(1, &surface.grid_buffer);
+		glBindVertexArray(surface.vertex_array);
+		glBindBuffer(GL_ARRAY_BUFFER, surface.grid_buffer);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+		glBindVertexArray(0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, surface.grid_buffer);
+	glBufferData(GL_ARRAY_BUFFER, grid.size() * sizeof(float), grid.data(), GL_STATIC_DRAW);
+
+	surface.resolution = resolution;
+	surface.is_3d = is_3d;
+	surface.vertex_count = grid.size() / 2;
+}
+
+// Moves an equation onto the GPU: its program is transpiled to GLSL and built into a vertex shader
+// of its own. Returns false, with the reason in gpu_error, when the equation has to stay on the CPU.
+bool prepare_gpu_surface(Equation& equation) {
+	auto fall_back = [&](const std::string& reason) {
+		equation.gpu_error = reason;
+		release_gpu_surface(equation);
+		return false;
+	};
+	if (equation.double_precision)
+		return fall_back("GLSL 3.30 has no double precision");
+	if (equation.is_mesh)
+		return fall_back("meshes are only built on the CPU");
+
+	sync_parameters(equation);
+	std::shared_ptr<CompiledExpression<float>> compiled = expression_cache.get(equation.source, equation_variables(equation));
+	const std::shared_ptr<const Program> source = compiled->parametric_program ? compiled->parametric_program : compiled->program;
+	if (!compiled->valid || !source)
+		return fall_back("the equation only evaluates on exprtk");
+
+	begin_generation(equation, *compiled);
+	equation.gpu_error.clear();
+	if (equation.gpu && equation.gpu->source == source)
+		return true;
+
+	std::string function, error;
+	if (!transpile_glsl(*source, function, error))
+		return fall_back(error);
+
+	static const std::string fragment_source = [] {
+		std::ifstream file("shader.fs");
+		std::stringstream text;
+		text << file.rdbuf();
+		return text.str();
+	}();
+	const size_t parameter_count = source->inputs.size() - first_parameter;
+	auto shader = std::make_shared<Shader>(gpu_vertex_shader(function, parameter_count), fragment_source);
+	if (!shader->error.empty()) {
+		glDeleteProgram(shader->ID);
+		return fall_back(shader->error);
+	}
+
+	release_gpu_surface(equation);
+	equation.gpu = std::make_shared<GpuSurface>();
+	equation.gpu->source = source;
+	equation.gpu->shader = shader;
+	equation.gpu->parameter_count = parameter_count;
+	return true;
+}
+
+void generate_vertices(Equation& equation) {
+	equation.is_preview = false;
+	equation.generation++;
+	if (!equation.reference_error.empty()) {
+		release_gpu_surface(equation);
+		equation.points_vec_equation.clear();
+		equation.indices.clear();
+		return;
+	}
+	if (equation.gpu_evaluation && prepare_gpu_surface(equation)) {
+		equation.points_vec_equation.clear();
+		equation.indices.clear();
+		return;
+	}
+	release_gpu_surface(equation);
+
+	if (equation.double_precision)
+		generate_samples(equation, double_expression_cache);
+	else
+		generate_samples(equation, expression_cache);
+}
+
+void move_parameters(Equation& equation) {
+	// GPU surfaces read the parameters as uniforms when they are drawn
+	if (equation.gpu)
+		return;
+	if (equation.double_precision)
+		update_parameters(equation, double_expression_cache);
+	else
+		update_parameters(equation, expression_cache);
+}
+
+// Starts computing every frame of the equation's sweep in the background, on the samples of its
+// last generation. Equations without a lowered program to reuse are left alone.
+template <typename T>
+void start_sweep(Equation& equation, ExpressionCache<T>& cache) {
+	std::shared_ptr<CompiledExpression<T>> compiled = cache.get(equation.source, equation_variables(equation));
+	const std::shared_ptr<const PartialEvaluation<T>> partial = partial_evaluation<T>(equation);
+	if (!compiled->valid || !partial || partial->source != compiled->parametric_program || equation.parameters.empty())
+		return;
+
+	const std::shared_ptr<const Program> residual = compiled->residual_program ? compiled->residual_program : compiled->parametric_program;
+	const std::vector<double> values = parameter_values(equation);
+	const size_t parameter = std::min<size_t>(equation.sweep_parameter, values.size() - 1);
+	const size_t frames = std::max(equation.sweep_frames, 1);
+	const double from = equation.sweep_from;
+	const double to = equation.sweep_to;
+	const double min_z = equation.min_z;
+	const double max_z = equation.max_z;
+	const bool is_3d = equation.is_3d;
+	const MathAccuracy accuracy = equation.accuracy;
+	const size_t cols = is_3d ? partial->x_samples.size() : 1;
+	const size_t rows = is_3d ? partial->y_samples.size() : partial->x_samples.size();
+
+	auto sweep = std::make_shared<ParameterSweep>();
+	for (size_t i = 0; i < partial->x_samples.size(); i++) {
+		for (size_t j = 0; j < (is_3d ? rows : 1); j++) {
+			const float y = is_3d ? static_cast<float>(partial->y_samples[j]) : 0.0f;
+			sweep->base.insert(sweep->base.end(), { static_cast<float>(partial->x_samples[i]), 0.0f, y, equation.data[0], equation.data[1], equation.data[2] });
+		}
+	}
+
+	// each frame runs on one worker, so its columns are evaluated serially
+	sweep->start(frames, cols * rows, [=](size_t frame, float* out) {
+		std::vector<double> frame_values = values;
+		frame_values[parameter] = frames > 1 ? from + (to - from) * frame / (frames - 1) : from;
+		const Program program = bind_inputs(*residual, first_parameter, frame_values);
+
+		std::vector<T> column_x(rows), zeros(rows, T(0)), heights(rows);
+		T* column_out = heights.data();
+		std::vector<const T*> inputs(first_parameter + partial->cached.size(), zeros.data());
+		for (size_t i = 0; i < cols; i++) {
+			if (is_3d) {
+				std::fill(column_x.begin(), column_x.end(), partial->x_samples[i]);
+				inputs[0] = column_x.data();
+				inputs[1] = partial->y_samples.data();
+			}
+			else {
+				inputs[0] = partial->x_samples.data();
+			}
+			for (size_t k = 0; k < partial->cached.size(); k++)
+				inputs[first_parameter + k] = partial->cached[k].data() + i * rows;
+			evaluate_batch_outputs(program, inputs.data(), &column_out, rows, accuracy);
+
+			for (size_t j = 0; j < rows; j++) {
+				const T z = heights[j];
+				out[i * rows + j] = std::isfinite(z) && z >= min_z && z <= max_z ? static_cast<float>(z) : std::numeric_limits<float>::quiet_NaN();
+			}
+		}
+	});
+	equation.sweep = sweep;
+}
+
+void begin_sweep(Equation& equation) {
+	if (equation.double_precision)
+		start_sweep(equation, double_expression_cache);
+	else
+		start_sweep(equation, expression_cache);
+}
+
+// Samples a sweep of the equation would cover; zero until it has been generated.
+size_t sweep_samples(const Equation& equation) {
+	auto count = [&](const auto& partial) {
+		return partial ? partial->x_samples.size() * (equation.is_3d ? partial->y_samples.size() : 1) : 0;
+	};
+	return equation.double_precision ? count(equation.double_partial) : count(equation.float_partial);
+}
+
+void release_sweep(Equation& equation) {
+	if (!equation.sweep)
+		return;
+	ParameterSweep& sweep = *equation.sweep;
+	sweep.cancel();
+	if (sweep.uploaded) {
+		glDeleteVertexArrays(1, &sweep.vertex_array);
+		glDeleteBuffers(1, &sweep.base_buffer);
+		glDeleteBuffers(1, &sweep.height_buffer);
+	}
+	equation.sweep.reset();
+}
+
+// Evaluates columns of the equation's current animation pass until the deadline, starting a pass at
+// the current time when none is running. At least one chunk runs so every equation makes progress.
+// Returns true when a pass completed and the vertices were replaced.
+template <typename T>
+bool advance_animation(Equation& equation, ExpressionCache<T>& cache, std::chrono::steady_clock::time_point deadline) {
+	std::shared_ptr<CompiledExpression<T>> compiled = cache.get(equation.source, equation_variables(equation));
+	const std::shared_ptr<PartialEvaluation<T>> partial = partial_evaluation<T>(equation);
+	// equations that stay on exprtk, or have not been generated yet, do not animate
+	if (!compiled->valid || !partial || partial->source != compiled->parametric_program)
+		return false;
+
+	const size_t cols = partial->x_samples.size();
+	const size_t rows = equation.is_3d ? partial->y_samples.size() : 1;
+	if (!partial->pass) {
+		for (auto& parameter : equation.parameters) {
+			if (parameter.animated)
+				parameter.value = static_cast<float>(glfwGetTime());
+		}
+		partial->pass = std::make_shared<Program>(bind_residual(equation, *compiled));
+		partial->heights.assign(cols * rows, T(0));
+		partial->next_column = 0;
+	}
+
+	const size_t chunk = equation.is_3d ? animation_chunk * thread_pool.size() : cols;
+	const std::vector<const T*> cached = cached_inputs(*partial);
+	do {
+		const size_t end = std::min(cols, partial->next_column + chunk);
+		sweep_columns(*partial->pass, partial->x_samples, partial->y_samples, equation, cached, { partial->heights.data() }, partial->next_column, end);
+		partial->next_column = end;
+	} while (partial->next_column < cols && std::chrono::steady_clock::now() < deadline);
+	if (partial->next_column < cols)
+		return false;
+
+	compiled->set_parameters(parameter_values(equation));
+	begin_generation(equation, *compiled);
+	equation.points_vec_equation.clear();
+	equation.indices.clear();
+
+	SurfaceGrid<T> grid;
+	grid.x_samples = partial->x_samples;
+	grid.y_samples = partial->y_samples;
+	grid.heights.swap(partial->heights);
+	emit_vertices(equation, *compiled, grid);
+	partial->pass.reset();
+	return true;
+}
+
+// Generates equations that share a domain and sample count in one sweep of a fused program. Every
+// equation is sampled on the union of the axes it would pick alone, so each sample is evaluated once
+// for all of them. Equations without a program, or with a separable or polynomial form that is cheaper
+// than a grid pass, are generated on their own.
+template <typename T>
+void generate_fused(const std::vector<Equation*>& group, ExpressionCache<T>& cache) {
+	std::vector<Equation*> members;
+	std::vector<std::shared_ptr<CompiledExpression<T>>> compiled;
+	std::vector<std::string> texts;
+	for (Equation* equation : group) {
+		std::shared_ptr<CompiledExpression<T>> expression = cache.get(equation->source, { "x", "y", "z" });
+		if (!expression->valid || !expression->program || expression->separation != Separation::None || expression->polynomial) {
+			generate_samples(*equation, cache);
+			continue;
+		}
+		// a mesh this equation generated on its own, on a fresh lattice, stands in for its share of the group
+		const std::string key = mesh_cache_key<T>(*equation, nullptr);
+		if (!key.empty()) {
+			begin_generation(*equation, *expression);
+			if (restore_mesh(*equation, key))
+				continue;
+		}
+		members.push_back(equation);
+		compiled.push_back(expression);
+		texts.push_back(equation->source);
+	}
+
+	FusedProgram fused;
+	if (members.size() < 2 || !cache.fuse(texts, { "x", "y", "z" }, fused)) {
+		for (Equation* equation : members)
+			generate_samples(*equation, cache);
+		return;
+	}
+	fused_equations += members.size();
+	fused_operations += fused.operations;
+	separate_operations += fused.separate_operations;
+
+	SurfaceGrid<T> shared;
+	for (size_t k = 0; k < members.size(); k++) {
+		begin_generation(*members[k], *compiled[k]);
+		SurfaceGrid<T> grid;
+		sample_axes(*members[k], *compiled[k], grid);
+		shared.x_samples.insert(shared.x_samples.end(), grid.x_samples.begin(), grid.x_samples.end());
+		shared.y_samples.insert(shared.y_samples.end(), grid.y_samples.begin(), grid.y_samples.end());
+	}
+	for (std::vector<T>* axis : { &shared.x_samples, &shared.y_samples }) {
+		std::sort(axis->begin(), axis->end());
+		axis->erase(std::unique(axis->begin(), axis->end()), axis->end());
+	}
+
+	const size_t cols = shared.x_samples.size();
+	const size_t rows = std::max<size_t>(shared.y_samples.size(), 1);
+	std::vector<SurfaceGrid<T>> grids(members.size());
+	for (auto& grid : grids) {
+		grid.x_samples = shared.x_samples;
+		grid.y_samples = shared.y_samples;
+		grid.heights.assign(cols * rows, T(0));
+	}
+
+	std::vector<T*> outs;
+	for (auto& grid : grids)
+		outs.push_back(grid.heights.data());
+	sweep_grid(*fused.program, shared, *members[0], {}, outs);
+
+	// sampled on the axes of the whole group, so not what the key of any one member describes
+	for (size_t k = 0; k < members.size(); k++)
+		emit_vertices(*members[k], *compiled[k], grids[k]);
+}
+
+// Replaces the contents of a streamed buffer. The storage is orphaned first, so the driver can hand
+// out a fresh block instead of waiting for frames that still draw from the old one. Capacity only
+// grows, which keeps a surface that changes size every frame from reallocating every frame.
+void stream_buffer(GLenum target, GLsizeiptr& capacity, const void* data, GLsizeiptr size) {
+	if (size > capacity)
+		capacity = std::max(size, capacity * 2);
+	glBufferData(target, capacity, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(target, 0, size, data);
+}
+
 void rerender(Shader& shader) {
-	glDeleteVertexArrays(1, &VAO);
-	glDeleteBuffers(1, &VBO);
-	glDeleteBuffers(1, &EBO);
+	if (VAO == 0) {
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+		glEnableVertexAttribArray(1);
+	}
 
 	points_vec.clear();
 	indices_vec.clear();
 
+	// each vertex is a position followed by a colour, and indices count vertices
 	size_t vertex_offset = 0;
 	for (auto& equation : equations) {
-		if (equation.is_visible) {
-			points_vec.insert(points_vec.begin(), equation.points_vec_equation.begin(), equation.points_vec_equation.end());
-		}
+		if (!equation.is_visible || (equation.sweep && equation.sweep->uploaded))
+			continue;
+		points_vec.insert(points_vec.end(), equation.points_vec_equation.begin(), equation.points_vec_equation.end());
 
 		if (equation.is_mesh) {
 			for (auto& index : equation.indices) {
 				indices_vec.push_back(index + vertex_offset);
 			}
 		}
-		vertex_offset += equation.points_vec_equation.size();
+		vertex_offset += equation.points_vec_equation.size() / 2;
 	}
 
 	for (auto& point : points) {
 		points_vec.insert(points_vec.end(), point.point_data.begin(), point.point_data.end());
 	}
 
-	glm::vec3* new_points = points_vec.data();
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	stream_buffer(GL_ARRAY_BUFFER, vertex_capacity, points_vec.data(), points_vec.size() * sizeof(glm::vec3));
+	stream_buffer(GL_ELEMENT_ARRAY_BUFFER, index_capacity, indices_vec.data(), indices_vec.size() * sizeof(unsigned int));
+}
 
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
+// Spends up to animation_budget milliseconds advancing the equations that use t, and uploads the
+// surfaces whose pass completed.
+void animate_equations(Shader& shader) {
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(static_cast<long long>(animation_budget * 1000.0f));
+	bool completed = false;
+	for (auto& equation : equations) {
+		if (!equation.is_visible || !is_animated(equation) || equation.sweep || equation.gpu)
+			continue;
+		if (equation.double_precision)
+			completed |= advance_animation(equation, double_expression_cache, deadline);
+		else
+			completed |= advance_animation(equation, expression_cache, deadline);
+	}
+	if (completed)
+		rerender(shader);
+}
 
-	glBindVertexArray(VAO);
+// Moves every sweep whose frames are all computed to the GPU, all frames in one buffer.
+void upload_sweeps(Shader& shader) {
+	bool uploaded = false;
+	for (auto& equation : equations) {
+		if (!equation.sweep || equation.sweep->uploaded || !equation.sweep->finished())
+			continue;
+		ParameterSweep& sweep = *equation.sweep;
+		sweep.join();
+
+		glGenVertexArrays(1, &sweep.vertex_array);
+		glGenBuffers(1, &sweep.base_buffer);
+		glGenBuffers(1, &sweep.height_buffer);
+		glBindVertexArray(sweep.vertex_array);
+
+		glBindBuffer(GL_ARRAY_BUFFER, sweep.base_buffer);
+		glBufferData(GL_ARRAY_BUFFER, sweep.base.size() * sizeof(float), sweep.base.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+		glEnableVertexAttribArray(1);
+
+		glBindBuffer(GL_ARRAY_BUFFER, sweep.height_buffer);
+		glBufferData(GL_ARRAY_BUFFER, sweep.heights.size() * sizeof(float), sweep.heights.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(2);
+		glBindVertexArray(0);
+
+		std::vector<float>().swap(sweep.base);
+		std::vector<float>().swap(sweep.heights);
+		sweep.uploaded = true;
+		uploaded = true;
+	}
+	// swept equations are drawn from their sweep instead of the shared buffer
+	if (uploaded)
+		rerender(shader);
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, points_vec.size() * sizeof(glm::vec3), new_points, GL_STATIC_DRAW);
+// Draws the current frame of every sweep. Scrubbing only moves where the height attribute starts.
+void draw_sweeps(Shader& shader) {
+	shader.setBool("use_sweep", true);
+	for (auto& equation : equations) {
+		if (!equation.is_visible || !equation.sweep || !equation.sweep->uploaded)
+			continue;
+		const ParameterSweep& sweep = *equation.sweep;
+		glBindVertexArray(sweep.vertex_array);
+		glBindBuffer(GL_ARRAY_BUFFER, sweep.height_buffer);
+		glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)(sweep.frame * sweep.sample_count * sizeof(float)));
+		shader.setFloat("point_opacity", equation.opacity);
+		glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(sweep.sample_count));
+	}
+	glBindVertexArray(0);
+	shader.setBool("use_sweep", false);
+}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_vec.size() * sizeof(unsigned int), indices_vec.data(), GL_STATIC_DRAW);
+// Draws every equation evaluated on the GPU. Bounds, parameters and the clock are uniforms, so
+// changing them never regenerates anything; only a new sample size refills the grid.
+void draw_gpu_surfaces(Shader& shader, const glm::mat4& projection, const glm::mat4& view) {
+	for (auto& equation : equations) {
+		if (!equation.is_visible || !equation.gpu)
+			continue;
+		GpuSurface& surface = *equation.gpu;
+		const int resolution = std::clamp(equation.sample_size, 2, max_gpu_resolution);
+		if (surface.resolution != resolution || surface.is_3d != equation.is_3d)
+			upload_gpu_grid(surface, resolution, equation.is_3d);
+
+		std::vector<float> values;
+		for (auto& parameter : equation.parameters) {
+			if (parameter.animated && animate)
+				parameter.value = static_cast<float>(glfwGetTime());
+			values.push_back(parameter.value);
+		}
+		values.resize(surface.parameter_count, 0.0f);
+
+		Shader& surface_shader = *surface.shader;
+		surface_shader.use();
+		surface_shader.setMat4("model", glm::mat4(1.0f));
+		surface_shader.setMat4("view", view);
+		surface_shader.setMat4("projection", projection);
+		surface_shader.setFloat("point_size", point_size);
+		surface_shader.setVec3("color", glm::make_vec3(equation.data));
+		surface_shader.setFloat("point_opacity", equation.opacity);
+		surface_shader.setBool("use_heatmap", use_heatmap);
+		// the heights never reach the CPU, so without a Z range the heatmap spans the domain
+		surface_shader.setFloat("min_height", std::isfinite(equation.min_z) ? equation.min_z : equation.min_x);
+		surface_shader.setFloat("max_height", std::isfinite(equation.max_z) ? equation.max_z : equation.max_x);
+		surface_shader.setVec2("x_range", equation.min_x, equation.max_x);
+		surface_shader.setVec2("y_range", equation.is_3d ? equation.min_y : 0.0f, equation.is_3d ? equation.max_y : 0.0f);
+		surface_shader.setVec2("z_range", std::max(equation.min_z, -FLT_MAX), std::min(equation.max_z, FLT_MAX));
+		if (!values.empty())
+			glUniform1fv(glGetUniformLocation(surface_shader.ID, "parameters"), static_cast<GLsizei>(values.size()), values.data());
+
+		glBindVertexArray(surface.vertex_array);
+		glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(surface.vertex_count));
+	}
+	glBindVertexArray(0);
+	shader.use();
+}
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
+// Regenerates every visible equation, fusing those with the same dimensions, domain, sample count
+// and precision.
+void render_all(Shader& shader) {
+	fused_equations = fused_operations = separate_operations = 0;
+	resolve_equations();
 
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
+	std::vector<std::vector<Equation*>> groups;
+	for (auto& equation : equations) {
+		if (!equation.is_visible)
+			continue;
+		equation.points_vec_equation.clear();
+		equation.indices.clear();
+		// fused equations never pass through generate_vertices
+		equation.is_preview = false;
+		equation.generation++;
+
+		auto same_grid = [&](const Equation* other) {
+			return other->parameters.empty() && equation.parameters.empty() && !other->gpu_evaluation && !equation.gpu_evaluation &&
+				other->is_3d == equation.is_3d && other->double_precision == equation.double_precision && other->accuracy == equation.accuracy &&
+				other->sample_size == equation.sample_size &&
+				other->min_x == equation.min_x && other->max_x == equation.max_x &&
+				(!equation.is_3d || (other->min_y == equation.min_y && other->max_y == equation.max_y));
+		};
+		auto group = std::find_if(groups.begin(), groups.end(), [&](const std::vector<Equation*>& g) { return same_grid(g[0]); });
+		if (group == groups.end())
+			groups.push_back({ &equation });
+		else
+			group->push_back(&equation);
+	}
+
+	for (const auto& group : groups) {
+		if (group.size() == 1)
+			generate_vertices(*group[0]);
+		else if (group[0]->double_precision)
+			generate_fused(group, double_expression_cache);
+		else
+			generate_fused(group, expression_cache);
+	}
+	rerender(shader);
 }
 
 void remove_equation(int index) {
+	release_sweep(equations[index]);
+	release_gpu_surface(equations[index]);
 	equations.erase(equations.begin() + index);
+	resolve_equations();
 }
 
 void remove_point(int index) {
 	points.erase(points.begin() + index);
 }
 
+// Queues the equation's text for the preview compiler, with a copy of the settings it is drawn with.
+void submit_preview(Equation& equation) {
+	if (!equation.preview)
+		equation.preview = std::make_shared<PreviewSlot>();
+
+	PreviewRequest request;
+	request.text = equation.source;
+	request.library = function_library.source();
+	request.parameters = equation.parameters;
+	request.is_3d = equation.is_3d;
+	request.min_x = equation.min_x;
+	request.max_x = equation.max_x;
+	request.min_y = equation.min_y;
+	request.max_y = equation.max_y;
+	request.min_z = equation.min_z;
+	request.max_z = equation.max_z;
+	std::copy(std::begin(equation.data), std::end(equation.data), request.colour);
+	request.accuracy = equation.accuracy;
+	request.generation = equation.generation;
+	preview_compiler.submit(equation.preview, request);
+}
+
+// Takes the preview compiler's latest result for the equation: its error, or a coarse surface that
+// is drawn until the equation is rendered. Results for text that has changed since, or requested
+// before the equation was last generated or had its bounds moved, are dropped.
+void apply_preview(Equation& equation, Shader& shader) {
+	PreviewResult result;
+	if (!equation.preview || !PreviewCompiler::take(*equation.preview, result) || result.text != equation.source || result.generation != equation.generation)
+		return;
+	equation.compile_error = result.error;
+	if (!result.valid)
+		return;
+
+	// whatever was built from the previous text no longer applies
+	release_sweep(equation);
+	release_gpu_surface(equation);
+	equation.float_partial.reset();
+	equation.double_partial.reset();
+	sync_parameters(equation);
+
+	equation.points_vec_equation = std::move(result.vertices);
+	equation.indices.clear();
+	equation.is_preview = true;
+	if (equation.is_visible)
+		rerender(shader);
+}
+
+// Builds the derivative of an equation along x, or for a surface its partial derivatives along x and
+// y, as new equations drawn with the same settings. Returns false with the reason in error.
+bool differentiate_equation(Equation& equation, std::vector<Equation>& derived, std::string& error) {
+	sync_parameters(equation);
+	ExpressionParser parser;
+	ExprTree tree;
+	if (!parser.parse(equation.source, equation_variables(equation), tree, &function_library.trees())) {
+		error = "only equations that lower to a program can be differentiated";
+		return false;
+	}
+
+	SymbolicDifferentiator differentiator;
+	ExpressionPrinter printer;
+	std::vector<Equation> results;
+	for (int axis = 0; axis < (equation.is_3d ? 2 : 1); axis++) {
+		const std::string text = printer.print(differentiator.differentiate(tree, axis));
+		if (text.size() >= sizeof(equation.buf)) {
+			error = "the derivative is " + std::to_string(text.size()) + " characters, more than an equation holds";
+			return false;
+		}
+
+		Equation result;
+		std::strcpy(result.buf, text.c_str());
+		// each derivative gets the colour channels rotated, so it stands apart from the original
+		for (int i = 0; i < 3; i++)
+			result.data[i] = equation.data[(i + axis + 1) % 3];
+		result.sample_size = equation.sample_size;
+		result.min_x = equation.min_x;
+		result.max_x = equation.max_x;
+		result.min_y = equation.min_y;
+		result.max_y = equation.max_y;
+		result.min_z = equation.min_z;
+		result.max_z = equation.max_z;
+		result.is_3d = equation.is_3d;
+		result.opacity = equation.opacity;
+		result.is_mesh = equation.is_mesh;
+		result.discontinuity_threshold = equation.discontinuity_threshold;
+		result.double_precision = equation.double_precision;
+		result.accuracy = equation.accuracy;
+		result.gpu_evaluation = equation.gpu_evaluation;
+		result.parameters = equation.parameters;
+		results.push_back(result);
+	}
+	derived.insert(derived.end(), results.begin(), results.end());
+	return true;
+}
+
+// Regenerates an equation and then every equation that refers to it, directly or not, each after
+// the equations it refers to. Equations outside that chain keep their vertices.
+void render_dependents(size_t index, Shader& shader) {
+	resolve_equations();
+	for (size_t k : equation_graph.dependents(index)) {
+		equations[k].points_vec_equation.clear();
+		equations[k].indices.clear();
+		generate_vertices(equations[k]);
+	}
+	rerender(shader);
+}
+
 void draw_equation_input(Equation& equation, Shader& shader, size_t index) {
-	ImGui::InputText("Equation", equation.buf, sizeof(equation.buf));
+	apply_preview(equation, shader);
+	if (ImGui::InputText("Name", equation.name, sizeof(equation.name)))
+		resolve_equations();
+	if (ImGui::InputText("Equation", equation.buf, sizeof(equation.buf))) {
+		resolve_equations();
+		if (equation.reference_error.empty())
+			submit_preview(equation);
+	}
+	if (!equation.reference_error.empty())
+		ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "%s", equation.reference_error.c_str());
+	else if (!equation.compile_error.empty())
+		ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "%s", equation.compile_error.c_str());
+	else if (equation.is_preview)
+		ImGui::Text("Coarse preview; Render for the full surface");
 	ImGui::ColorEdit3("Colour", equation.data);
 	ImGui::SliderInt("Sample Size", &equation.sample_size, 1, 10000);
-	ImGui::SliderFloat("Minimum X", &equation.min_x, min_x_val, -0);
-	ImGui::SliderFloat("Maximum X", &equation.max_x, 1, max_x_val);
-	ImGui::SliderFloat("Minimum Y", &equation.min_y, min_y_val, -0);
-	ImGui::SliderFloat("Maximum Y", &equation.max_y, 1, max_y_val);
+	bool bounds_change = ImGui::SliderFloat("Minimum X", &equation.min_x, min_x_val, -0);
+	bounds_change |= ImGui::SliderFloat("Maximum X", &equation.max_x, 1, max_x_val);
+	bounds_change |= ImGui::SliderFloat("Minimum Y", &equation.min_y, min_y_val, -0);
+	bounds_change |= ImGui::SliderFloat("Maximum Y", &equation.max_y, 1, max_y_val);
+	bounds_change |= ImGui::SliderFloat("Minimum Z", &equation.min_z, min_z_val, -0);
+	bounds_change |= ImGui::SliderFloat("Maximum Z", &equation.max_z, 1, max_z_val);
+	if (bounds_change) {
+		// a preview still in flight was sampled over the old bounds
+		equation.generation++;
+		if (equation.is_preview)
+			submit_preview(equation);
+	}
 	ImGui::SliderFloat("Opacity", &equation.opacity, 0, 1);
 	bool visibility_toggle = ImGui::Checkbox("Toggle Visibility", &equation.is_visible);
 	bool toggle_3d = ImGui::Checkbox("Toggle 3D", &equation.is_3d);
 	bool heatmap_toggle = ImGui::Checkbox("Toggle Heatmap", &use_heatmap);
 	bool mesh_toggle = ImGui::Checkbox("Toggle Mesh (might not work for all functions)", &equation.is_mesh);
+	bool precision_toggle = ImGui::Checkbox("Double Precision (slower, for deep zoom)", &equation.double_precision);
+	bool gpu_toggle = ImGui::Checkbox("Evaluate on GPU", &equation.gpu_evaluation);
+	if (equation.gpu_evaluation && !equation.gpu_error.empty())
+		ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.2f, 1.0f), "Drawn on the CPU: %s", equation.gpu_error.c_str());
+	int accuracy = static_cast<int>(equation.accuracy);
+	const char* accuracy_names[] = { math_accuracy_name(MathAccuracy::Approximate), math_accuracy_name(MathAccuracy::Close), math_accuracy_name(MathAccuracy::Exact) };
+	bool accuracy_change = ImGui::Combo("Math Accuracy", &accuracy, accuracy_names, 3);
+	equation.accuracy = static_cast<MathAccuracy>(accuracy);
+	for (size_t i = 0; i < equation.parameters.size(); i++) {
+		Parameter& parameter = equation.parameters[i];
+		if (parameter.animated && animate) {
+			ImGui::Text("%s = %.2f", parameter.name.c_str(), parameter.value);
+			continue;
+		}
+		ImGui::PushID(static_cast<int>(i));
+		ImGui::SliderFloat(parameter.name.c_str(), &parameter.value, parameter.min, parameter.max);
+		if (ImGui::IsItemEdited() || ImGui::IsItemDeactivatedAfterEdit()) {
+			equation.points_vec_equation.clear();
+			equation.indices.clear();
+
+			// while dragging only the residual runs; releasing resamples the axes for the new shape
+			if (ImGui::IsItemDeactivatedAfterEdit())
+				generate_vertices(equation);
+			else
+				move_parameters(equation);
+			rerender(shader);
+		}
+		ImGui::PopID();
+	}
+	if (!equation.parameters.empty() && !equation.gpu && ImGui::TreeNode("Parameter Sweep")) {
+		std::vector<const char*> names;
+		for (const auto& parameter : equation.parameters)
+			names.push_back(parameter.name.c_str());
+		equation.sweep_parameter = std::min(equation.sweep_parameter, static_cast<int>(names.size()) - 1);
+
+		if (!equation.sweep) {
+			ImGui::Combo("Swept Parameter", &equation.sweep_parameter, names.data(), static_cast<int>(names.size()));
+			ImGui::InputFloat("From", &equation.sweep_from);
+			ImGui::InputFloat("To", &equation.sweep_to);
+			ImGui::InputInt("Frames", &equation.sweep_frames);
+			equation.sweep_frames = std::max(equation.sweep_frames, 1);
+
+			const size_t samples = sweep_samples(equation);
+			if (samples == 0) {
+				ImGui::Text("Render the equation before sweeping it");
+			}
+			else {
+				const size_t bytes = ParameterSweep::bytes(equation.sweep_frames, samples) + samples * 6 * sizeof(float);
+				ImGui::Text("%d frames of %zu samples: %.1f MB of GPU memory", equation.sweep_frames, samples, bytes / (1024.0 * 1024.0));
+				if (ImGui::Button("Precompute Sweep"))
+					begin_sweep(equation);
+			}
+		}
+		else if (!equation.sweep->uploaded) {
+			const ParameterSweep& sweep = *equation.sweep;
+			ImGui::ProgressBar(static_cast<float>(sweep.completed) / sweep.frame_count);
+			if (ImGui::Button("Cancel Sweep"))
+				release_sweep(equation);
+		}
+		else {
+			ParameterSweep& sweep = *equation.sweep;
+			ImGui::SliderInt("Frame", &sweep.frame, 0, static_cast<int>(sweep.frame_count) - 1);
+			const float value = sweep.frame_count > 1 ? equation.sweep_from + (equation.sweep_to - equation.sweep_from) * sweep.frame / (sweep.frame_count - 1) : equation.sweep_from;
+			ImGui::Text("%s = %.3f", names[equation.sweep_parameter], value);
+			if (ImGui::Button("Stop Sweep")) {
+				release_sweep(equation);
+				rerender(shader);
+			}
+		}
+		ImGui::TreePop();
+	}
+	if (equation.parsed_operations > 0)
+		ImGui::Text("Operations per sample: %zu (%zu before simplification)", equation.simplified_operations, equation.parsed_operations);
+	for (size_t i = 1; i < static_cast<size_t>(DomainError::Count); i++) {
+		if (equation.domain_errors[i] > 0)
+			ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.2f, 1.0f), "%zu samples missing: %s", equation.domain_errors[i], domain_error_name(static_cast<DomainError>(i)));
+	}
+	if (equation.clipped_samples > 0)
+		ImGui::Text("%zu samples outside the Z range", equation.clipped_samples);
 	if (ImGui::Button("Remove Equation")) {
 		equation.points_vec_equation.clear();
 		equation.indices.clear();
 
 		remove_equation(index);
 
-		generate_vertices(equation);
+		// equation now refers to the element erased, or the one that took its place
 		rerender(shader);
+		return;
 	}
 	ImGui::SameLine();
-	if (ImGui::Button("Render")) {
-		equation.points_vec_equation.clear();
-		equation.indices.clear();
-
-		generate_vertices(equation);
-		rerender(shader);
+	if (ImGui::Button("Render"))
+		render_dependents(index, shader);
+	ImGui::SameLine();
+	if (ImGui::Button("Differentiate")) {
+		equation.derivative_error.clear();
+		differentiate_equation(equation, derived_equations, equation.derivative_error);
 	}
-	if (visibility_toggle || toggle_3d || heatmap_toggle || mesh_toggle) {
+	if (!equation.derivative_error.empty())
+		ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.2f, 1.0f), "Cannot differentiate: %s", equation.derivative_error.c_str());
+	if (visibility_toggle || toggle_3d || heatmap_toggle || mesh_toggle || precision_toggle || accuracy_change || gpu_toggle) {
 		equation.points_vec_equation.clear();
 		equation.indices.clear();
 
@@ -353,6 +1704,16 @@ void draw_equations(Shader& shader) {
 		ImGui::PopID();
 		ImGui::Separator();
 	}
+
+	if (derived_equations.empty())
+		return;
+	const size_t first_derived = equations.size();
+	equations.insert(equations.end(), derived_equations.begin(), derived_equations.end());
+	derived_equations.clear();
+	resolve_equations();
+	for (size_t i = first_derived; i < equations.size(); i++)
+		generate_vertices(equations[i]);
+	rerender(shader);
 }
 
 void draw_points_input(Point& point, Shader& shader, size_t index) {
@@ -377,6 +1738,84 @@ void draw_points_input(Point& point, Shader& shader, size_t index) {
 	}
 }
 
+// Applies the library text and regenerates only the equations whose library symbols changed.
+void apply_library(Shader& shader) {
+	function_library.define(library_buf);
+	resolve_equations();
+
+	bool changed = false;
+	for (auto& equation : equations) {
+		if (equation.library_key == function_library.dependency_key(equation.source))
+			continue;
+		equation.points_vec_equation.clear();
+		equation.indices.clear();
+		generate_vertices(equation);
+		changed = true;
+	}
+	if (changed)
+		rerender(shader);
+}
+
+void draw_library(Shader& shader) {
+	ImGui::Begin("Function Library", &show_library);
+	ImGui::TextUnformatted("One definition per line, e.g. g(t) = exp(-t^2) or k = 3.7");
+	ImGui::InputTextMultiline("##library", library_buf, sizeof(library_buf), ImVec2(-1.0f, ImGui::GetTextLineHeight() * 10));
+	if (ImGui::Button("Apply"))
+		apply_library(shader);
+	for (const auto& definition : function_library.definitions()) {
+		if (!definition.error.empty())
+			ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s: %s", definition.name.c_str(), definition.error.c_str());
+	}
+	ImGui::End();
+}
+
+void draw_benchmark() {
+	ImGui::Begin("Benchmark", &show_benchmark, ImGuiWindowFlags_AlwaysAutoResize);
+	ImGui::Text("Million samples per second (batch uses %s)", simd_level_name(supported_simd_level()));
+	if (ImGui::BeginTable("Backends", 6, ImGuiTableFlags_Borders)) {
+		ImGui::TableSetupColumn("Equation");
+		ImGui::TableSetupColumn("Precision");
+		ImGui::TableSetupColumn("exprtk");
+		ImGui::TableSetupColumn("VM");
+		ImGui::TableSetupColumn("JIT");
+		ImGui::TableSetupColumn("Batch");
+		ImGui::TableHeadersRow();
+		for (const auto& result : benchmark_results) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(result.equation.c_str());
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(result.double_precision ? "double" : "float");
+			for (double rate : { result.exprtk_rate, result.vm_rate, result.jit_rate, result.batch_rate }) {
+				ImGui::TableNextColumn();
+				ImGui::Text("%.1f", rate / 1e6);
+			}
+		}
+		ImGui::EndTable();
+	}
+	ImGui::Text("Vector math: million samples per second and largest error in ulps");
+	if (ImGui::BeginTable("Math", 4, ImGuiTableFlags_Borders)) {
+		ImGui::TableSetupColumn("Function");
+		ImGui::TableSetupColumn("Accuracy");
+		ImGui::TableSetupColumn("Rate");
+		ImGui::TableSetupColumn("Max Error");
+		ImGui::TableHeadersRow();
+		for (const auto& result : math_benchmark_results) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(result.function.c_str());
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(math_accuracy_name(result.accuracy));
+			ImGui::TableNextColumn();
+			ImGui::Text("%.1f", result.rate / 1e6);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f", result.max_ulp);
+		}
+		ImGui::EndTable();
+	}
+	ImGui::End();
+}
+
 void draw_points(Shader& shader) {
 	for (size_t i = 0; i < points.size(); i++) {
 		ImGui::PushID(static_cast<int>(i));
@@ -446,6 +1885,25 @@ void import_data(const std::string& filename) {
 			
 			equations.push_back(eq);
 		}
+		else if (type == "Name") {
+			std::string name;
+			iss >> name;
+			if (!equations.empty()) {
+				std::strncpy(equations.back().name, name.c_str(), sizeof(equations.back().name) - 1);
+				equations.back().name[sizeof(equations.back().name) - 1] = '\0';
+			}
+		}
+		else if (type == "Define") {
+			std::string definition;
+			std::getline(iss, definition);
+			std::string source = function_library.source();
+			if (!source.empty() && source.back() != '\n')
+				source += '\n';
+			source += definition;
+			std::strncpy(library_buf, source.c_str(), sizeof(library_buf) - 1);
+			library_buf[sizeof(library_buf) - 1] = '\0';
+			function_library.define(library_buf);
+		}
 		else if (type == "Point") {
 			Point pt;
 			iss >> pt.point_buf[0] >> pt.point_buf[1] >> pt.point_buf[2];
@@ -455,6 +1913,7 @@ void import_data(const std::string& filename) {
 	}
 
 	infile.close();
+	resolve_equations();
 }
 
 void export_data(const std::string& filename) {
@@ -473,6 +1932,15 @@ void export_data(const std::string& filename) {
 			<< eq.min_y << " " << eq.max_y << " "
 			<< eq.is_visible << " " << eq.is_3d
 			<< eq.buf << "\" " << "\n";
+		if (eq.name[0] != '\0')
+			outfile << "Name " << eq.name << "\n";
+	}
+
+	std::istringstream library(function_library.source());
+	std::string definition;
+	while (std::getline(library, definition)) {
+		if (!definition.empty())
+			outfile << "Define " << definition << "\n";
 	}
 
 	for (const auto& pt : points) {
@@ -530,6 +1998,9 @@ int main() {
 
 	Shader shader("shader.vs", "shader.fs");
 
+	expression_cache.set_library(&function_library);
+	double_expression_cache.set_library(&function_library);
+
 	shader.use();
 
 	glm::mat4 model = glm::mat4(1.0f);
@@ -714,6 +2185,23 @@ int main() {
 				ImGui::Separator();
 				ImGui::InputDouble("Adjust Derivative Threshold", &derivative_threshold);
 				ImGui::InputInt("Adjust Depth", &max_depth);
+				ImGui::Checkbox("Show Function Library", &show_library);
+				ImGui::Checkbox("Animate t", &animate);
+				ImGui::SliderFloat("Animation Budget (ms per frame)", &animation_budget, 0.5f, 16.0f);
+				ImGui::InputInt("Memory Cache Size (MB)", &memory_cache_megabytes);
+				ImGui::SameLine();
+				ImGui::Text("%.1f MB in use", memory_cache.size() / (1024.0 * 1024.0));
+				ImGui::Checkbox("Cache Meshes on Disk", &use_disk_cache);
+				ImGui::InputInt("Disk Cache Size (MB)", &disk_cache_megabytes);
+				if (ImGui::Button("Clear Disk Cache"))
+					disk_cache.clear();
+				ImGui::SameLine();
+				ImGui::Text("%.1f MB in use", disk_cache.size() / (1024.0 * 1024.0));
+				if (ImGui::Button("Run Backend Benchmark")) {
+					benchmark_results = run_backend_benchmark(expression_cache, double_expression_cache);
+					math_benchmark_results = run_math_benchmark();
+					show_benchmark = true;
+				}
 				ImGui::Separator();
 				ImGui::Checkbox("Show Axes", &show_gridlines);
 				ImGui::Checkbox("Show Grid Lines", &show_lines);
@@ -721,6 +2209,8 @@ int main() {
 				ImGui::InputFloat("Change Maximum X value", &max_x_val);
 				ImGui::InputFloat("Change Minimum Y value", &min_y_val);
 				ImGui::InputFloat("Change Maximum Y value", &max_y_val);
+				ImGui::InputFloat("Change Minimum Z value", &min_z_val);
+				ImGui::InputFloat("Change Maximum Z value", &max_z_val);
 				ImGui::InputFloat("Set Point Size", &point_size);
 				ImGui::Separator();
 				ImGui::InputText("Filepath for Import (don't forget .mat extension)", import_filepath, sizeof(import_filepath));
@@ -763,6 +2253,9 @@ int main() {
 
 		draw_equations(shader);
 		draw_points(shader);
+		if (animate)
+			animate_equations(shader);
+		upload_sweeps(shader);
 
 
 		if (equations.size() >= 1) {
@@ -780,6 +2273,8 @@ int main() {
 
 		size_t array_start = indices_vec.empty() ? 0 : points_vec.size() - indices_vec.size();
 		glDrawArrays(GL_POINTS, array_start, points_vec.size() - array_start);
+		draw_sweeps(shader);
+		draw_gpu_surfaces(shader, projection, view);
 
 		if (ImGui::Button("Add Equation")) {
 			add_equation();
@@ -788,12 +2283,23 @@ int main() {
 		if (ImGui::Button("Add Point")) {	
 			add_point();
 		}
+		ImGui::SameLine();
+		if (ImGui::Button("Render All")) {
+			render_all(shader);
+		}
+		if (fused_equations > 0)
+			ImGui::Text("Fused %zu equations: %zu operations per sample (%zu separately)", fused_equations, fused_operations, separate_operations);
 		ImGui::Text("Camera Position: %s", glm::to_string(camera.Position).c_str());
 		ImGui::Text("%.1f FPS", io.Framerate);
 		ImGui::Text("Min Height: %.2f", min_height);
 		ImGui::Text("Max Height: %.2f", max_height);
 		ImGui::End();
 
+		if (show_benchmark)
+			draw_benchmark();
+		if (show_library)
+			draw_library(shader);
+
 		ImGui::Render();
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
@@ -801,12 +2307,18 @@ int main() {
 		glfwPollEvents();
 	}
 
+	for (auto& equation : equations) {
+		release_sweep(equation);
+		release_gpu_surface(equation);
+	}
+
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
 
 	glDeleteVertexArrays(1, &VAO);
 	glDeleteBuffers(1, &VBO);
+	glDeleteBuffers(1, &EBO);
 	glDeleteVertexArrays(1, &VAO_lines);
 	glDeleteBuffers(1, &VBO_lines);
 	glDeleteVertexArrays(1, &VAO_grid);
@@ -0,0 +1,353 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "domain_error.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A whole file mapped read-only. Empty when the file could not be opened or mapped.
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& path) {
+#if defined(_WIN32)
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+			return;
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping)
+			return;
+		void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!view)
+			return;
+		bytes = static_cast<const uint8_t*>(view);
+		length = static_cast<size_t>(file_size.QuadPart);
+#else
+		const int descriptor = open(path.c_str(), O_RDONLY);
+		if (descriptor < 0)
+			return;
+		struct stat status;
+		if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+			void* view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+			if (view != MAP_FAILED) {
+				bytes = static_cast<const uint8_t*>(view);
+				length = static_cast<size_t>(status.st_size);
+			}
+		}
+		// the mapping stays valid after the descriptor is closed
+		close(descriptor);
+#endif
+	}
+
+	~MappedFile() {
+#if defined(_WIN32)
+		if (bytes)
+			UnmapViewOfFile(bytes);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (bytes)
+			munmap(const_cast<uint8_t*>(bytes), length);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const uint8_t* data() const {
+		return bytes;
+	}
+
+	size_t size() const {
+		return length;
+	}
+
+private:
+	const uint8_t* bytes = nullptr;
+	size_t length = 0;
+#if defined(_WIN32)
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
+
+// What a generation produced, as stored in the cache.
+struct CachedMesh {
+	// positions followed by colours, like Equation::points_vec_equation
+	std::vector<glm::vec3> vertices;
+	std::vector<unsigned int> indices;
+	size_t clipped_samples = 0;
+	size_t domain_errors[static_cast<size_t>(DomainError::Count)] = {};
+};
+
+// Generated meshes on disk, one file per mesh named by the hash of its key. Each file holds a fixed
+// header, the key itself (to tell hash collisions apart), then the vertices and indices exactly as
+// they sit in memory, so a load is one mapping and two copies. Files are used least recently first
+// evicted: a hit touches the file's modification time, and a store removes the oldest files until
+// the directory fits the size cap. Every failure counts as a miss; the cache never stops a generation.
+class DiskMeshCache {
+public:
+	explicit DiskMeshCache(const std::string& directory) : directory(directory) {}
+
+	void set_capacity(uint64_t bytes) {
+		capacity = bytes;
+	}
+
+	bool load(const std::string& key, CachedMesh& mesh) {
+		const std::string path = entry_path(key);
+		{
+			MappedFile file(path);
+			if (!file.data() || file.size() < sizeof(Header))
+				return false;
+
+			Header header;
+			std::memcpy(&header, file.data(), sizeof(Header));
+			const uint64_t vertices_offset = align(sizeof(Header) + header.key_size);
+			const uint64_t indices_offset = vertices_offset + header.vertex_count * sizeof(glm::vec3);
+			if (std::memcmp(header.magic, magic, sizeof(header.magic)) != 0 || header.version != format_version ||
+				header.key_size != key.size() || header.vertex_count > file.size() || header.index_count > file.size() ||
+				indices_offset + header.index_count * sizeof(unsigned int) != file.size() ||
+				std::memcmp(file.data() + sizeof(Header), key.data(), key.size()) != 0)
+				return false;
+
+			mesh.vertices.resize(header.vertex_count);
+			mesh.indices.resize(header.index_count);
+			std::memcpy(mesh.vertices.data(), file.data() + vertices_offset, header.vertex_count * sizeof(glm::vec3));
+			std::memcpy(mesh.indices.data(), file.data() + indices_offset, header.index_count * sizeof(unsigned int));
+			mesh.clipped_samples = static_cast<size_t>(header.clipped_samples);
+			for (size_t i = 0; i < static_cast<size_t>(DomainError::Count); i++)
+				mesh.domain_errors[i] = static_cast<size_t>(header.domain_errors[i]);
+		}
+
+		std::error_code ignored;
+		std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ignored);
+		return true;
+	}
+
+	void store(const std::string& key, const CachedMesh& mesh) {
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		if (error)
+			return;
+
+		Header header = {};
+		std::memcpy(header.magic, magic, sizeof(header.magic));
+		header.version = format_version;
+		header.key_size = key.size();
+		header.vertex_count = mesh.vertices.size();
+		header.index_count = mesh.indices.size();
+		header.clipped_samples = mesh.clipped_samples;
+		for (size_t i = 0; i < static_cast<size_t>(DomainError::Count); i++)
+			header.domain_errors[i] = mesh.domain_errors[i];
+		const uint64_t size = align(sizeof(Header) + key.size()) + mesh.vertices.size() * sizeof(glm::vec3) + mesh.indices.size() * sizeof(unsigned int);
+		if (size > capacity)
+			return;
+
+		// written aside and renamed into place, so a reader never maps half a file
+		const std::string path = entry_path(key);
+		const std::string temporary = path + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			const char padding[alignment] = {};
+			file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+			file.write(key.data(), key.size());
+			file.write(padding, align(sizeof(Header) + key.size()) - (sizeof(Header) + key.size()));
+			file.write(reinterpret_cast<const char*>(mesh.vertices.data()), mesh.vertices.size() * sizeof(glm::vec3));
+			file.write(reinterpret_cast<const char*>(mesh.indices.data()), mesh.indices.size() * sizeof(unsigned int));
+			if (!file)
+				error = std::make_error_code(std::errc::io_error);
+		}
+		if (!error)
+			std::filesystem::rename(temporary, path, error);
+		if (error) {
+			std::filesystem::remove(temporary, error);
+			return;
+		}
+		evict();
+	}
+
+	// Removes every entry.
+	void clear() {
+		std::error_code ignored;
+		for (const auto& entry : std::filesystem::directory_iterator(directory, ignored)) {
+			if (entry.path().extension() == extension)
+				std::filesystem::remove(entry.path(), ignored);
+		}
+	}
+
+	// Bytes the entries take up on disk.
+	uint64_t size() const {
+		uint64_t total = 0;
+		std::error_code ignored;
+		for (const auto& entry : std::filesystem::directory_iterator(directory, ignored)) {
+			if (entry.path().extension() == extension)
+				total += entry.file_size(ignored);
+		}
+		return total;
+	}
+
+private:
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint64_t key_size;
+		uint64_t vertex_count;
+		uint64_t index_count;
+		uint64_t clipped_samples;
+		uint64_t domain_errors[static_cast<size_t>(DomainError::Count)];
+	};
+
+	static constexpr char magic[4] = { 'P', 'L', 'M', 'C' };
+	// bumped whenever the layout, or what generation produces for a key, changes
+	static const uint32_t format_version = 2;
+	static const size_t alignment = 16;
+	static constexpr const char* extension = ".mesh";
+
+	std::string directory;
+	uint64_t capacity = 256ull << 20;
+
+	static uint64_t align(uint64_t offset) {
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+
+	// 64-bit FNV-1a
+	static uint64_t hash(const std::string& key) {
+		uint64_t value = 14695981039346656037ull;
+		for (unsigned char c : key) {
+			value ^= c;
+			value *= 1099511628211ull;
+		}
+		return value;
+	}
+
+	std::string entry_path(const std::string& key) const {
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash(key)));
+		return (std::filesystem::path(directory) / (std::string(name) + extension)).string();
+	}
+
+	void evict() {
+		struct Entry {
+			std::filesystem::path path;
+			std::filesystem::file_time_type used;
+			uint64_t size;
+		};
+		std::vector<Entry> entries;
+		uint64_t total = 0;
+		std::error_code ignored;
+		for (const auto& entry : std::filesystem::directory_iterator(directory, ignored)) {
+			if (entry.path().extension() != extension)
+				continue;
+			entries.push_back({ entry.path(), entry.last_write_time(ignored), entry.file_size(ignored) });
+			total += entries.back().size;
+		}
+		if (total <= capacity)
+			return;
+
+		std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+		for (const Entry& entry : entries) {
+			if (total <= capacity)
+				break;
+			if (std::filesystem::remove(entry.path, ignored))
+				total -= entry.size;
+		}
+	}
+};
+
+// Recently generated meshes, so switching an equation back to a state it was just in swaps its
+// vertices in instead of generating them again. Keys are the same as on disk. Once the meshes
+// exceed the budget, the least recently used go first.
+class MemoryMeshCache {
+public:
+	void set_budget(size_t bytes) {
+		budget = bytes;
+		trim();
+	}
+
+	// The mesh under key, now the most recently used; null on a miss.
+	std::shared_ptr<const CachedMesh> find(const std::string& key) {
+		auto it = index.find(key);
+		if (it == index.end())
+			return nullptr;
+		entries.splice(entries.begin(), entries, it->second);
+		return it->second->mesh;
+	}
+
+	void insert(const std::string& key, const std::shared_ptr<const CachedMesh>& mesh) {
+		auto it = index.find(key);
+		if (it != index.end()) {
+			used -= it->second->bytes;
+			entries.erase(it->second);
+			index.erase(it);
+		}
+
+		const size_t bytes = key.size() + mesh->vertices.size() * sizeof(glm::vec3) + mesh->indices.size() * sizeof(unsigned int);
+		if (bytes > budget)
+			return;
+		entries.push_front({ key, mesh, bytes });
+		index[key] = entries.begin();
+		used += bytes;
+		trim();
+	}
+
+	void clear() {
+		entries.clear();
+		index.clear();
+		used = 0;
+	}
+
+	// Bytes the cached meshes take up.
+	size_t size() const {
+		return used;
+	}
+
+private:
+	struct Entry {
+		std::string key;
+		std::shared_ptr<const CachedMesh> mesh;
+		size_t bytes;
+	};
+
+	// most recently used first
+	std::list<Entry> entries;
+	std::unordered_map<std::string, std::list<Entry>::iterator> index;
+	size_t used = 0;
+	size_t budget = 128u << 20;
+
+	void trim() {
+		while (used > budget) {
+			used -= entries.back().bytes;
+			index.erase(entries.back().key);
+			entries.pop_back();
+		}
+	}
+};
+
+#endif // !MESH_CACHE_H
@@ -0,0 +1,110 @@
+#ifndef PARAMETERS_H
+#define PARAMETERS_H
+
+#include "expression_tree.hpp"
+#include "program.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Equations are compiled over x, y, z followed by their parameters.
+const size_t first_parameter = 3;
+
+// The parameter driven by the clock instead of a slider.
+const char time_parameter[] = "t";
+
+// A free symbol of an equation, shown as a slider.
+struct Parameter {
+	std::string name;
+	float value = 1.0f;
+	float min = -10.0f;
+	float max = 10.0f;
+	// follows the clock while animation runs
+	bool animated = false;
+};
+
+// Per-sample values of the subtrees of an equation that no parameter reaches. While a slider moves,
+// only the residual program runs over them.
+template <typename T>
+struct PartialEvaluation {
+	// the parametric program the values were cached for
+	std::shared_ptr<const Program> source;
+	std::vector<T> x_samples;
+	std::vector<T> y_samples;
+	// one array per base result, laid out like the height grid
+	std::vector<std::vector<T>> cached;
+
+	// An animation pass in progress: the residual bound to the time the pass started at, and the
+	// heights of every column before next_column.
+	std::shared_ptr<const Program> pass;
+	std::vector<T> heights;
+	size_t next_column = 0;
+};
+
+// More cached subtrees than this cost more memory than re-evaluating them saves.
+const size_t max_cached_subtrees = 8;
+
+// Splits a tree into its largest subtrees that no parameter reaches, and the residual that combines
+// them with the parameters. base keeps the tree with only the inputs before first_parameter, and
+// base_roots lists the cached subtrees; residual reads subtree i as the input after the parameters.
+// Returns false when there is nothing worth caching. Nodes come after their arguments, as the
+// parser and the simplifier build them.
+inline bool split_parameters(const ExprTree& tree, ExprTree& base, std::vector<int>& base_roots, ExprTree& residual) {
+	const size_t count = tree.nodes.size();
+	std::vector<char> varying(count, 0);
+	for (size_t i = 0; i < count; i++) {
+		const ExprNode& n = tree.nodes[i];
+		varying[i] = n.op == Op::Var && n.variable >= static_cast<int>(first_parameter);
+		for (int a = 0; a < op_arity(n.op); a++)
+			varying[i] |= varying[n.args[a]];
+	}
+
+	auto leaf = [&](int node) {
+		return tree.nodes[node].op == Op::Var || tree.nodes[node].op == Op::Const;
+	};
+
+	std::vector<int> cached_input(count, -1);
+	base_roots.clear();
+	auto cache = [&](int node) {
+		if (varying[node] || leaf(node) || cached_input[node] >= 0)
+			return;
+		cached_input[node] = static_cast<int>(base_roots.size());
+		base_roots.push_back(node);
+	};
+	for (size_t i = 0; i < count; i++) {
+		const ExprNode& n = tree.nodes[i];
+		if (!varying[i])
+			continue;
+		for (int a = 0; a < op_arity(n.op); a++)
+			cache(n.args[a]);
+	}
+	cache(tree.root);
+	if (base_roots.empty() || base_roots.size() > max_cached_subtrees)
+		return false;
+
+	base = tree;
+	base.variables.resize(first_parameter);
+	base.root = base_roots[0];
+
+	residual = ExprTree();
+	residual.variables = tree.variables;
+	for (size_t i = 0; i < base_roots.size(); i++)
+		residual.variables.push_back("cached" + std::to_string(i));
+
+	std::vector<int> copied(count, -1);
+	for (size_t i = 0; i < count; i++) {
+		if (cached_input[i] >= 0) {
+			copied[i] = residual.variable(static_cast<int>(tree.variables.size()) + cached_input[i]);
+			continue;
+		}
+		ExprNode node = tree.nodes[i];
+		for (int a = 0; a < op_arity(node.op); a++)
+			node.args[a] = copied[node.args[a]];
+		copied[i] = residual.add(node);
+	}
+	residual.root = copied[tree.root];
+	return true;
+}
+
+#endif // !PARAMETERS_H
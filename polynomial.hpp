@@ -0,0 +1,250 @@
+#ifndef POLYNOMIAL_H
+#define POLYNOMIAL_H
+
+#include "expression_tree.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// sum of coefficients[i * (degree_y + 1) + j] * x^i * y^j
+struct Polynomial {
+	int degree_x = 0;
+	int degree_y = 0;
+	std::vector<double> coefficients = { 0.0 };
+
+	double& at(int i, int j) {
+		return coefficients[i * (degree_y + 1) + j];
+	}
+
+	double at(int i, int j) const {
+		return coefficients[i * (degree_y + 1) + j];
+	}
+
+	static Polynomial constant(double value) {
+		Polynomial p;
+		p.coefficients[0] = value;
+		return p;
+	}
+
+	// coefficients of the polynomial in y once x is fixed, lowest power first
+	void row(double x, std::vector<double>& out) const {
+		out.assign(degree_y + 1, 0.0);
+		for (int j = 0; j <= degree_y; j++) {
+			double value = 0.0;
+			for (int i = degree_x; i >= 0; i--)
+				value = value * x + at(i, j);
+			out[j] = value;
+		}
+	}
+
+	// coefficients of the polynomial in x once y is fixed, lowest power first
+	void column(double y, std::vector<double>& out) const {
+		out.assign(degree_x + 1, 0.0);
+		for (int i = 0; i <= degree_x; i++) {
+			double value = 0.0;
+			for (int j = degree_y; j >= 0; j--)
+				value = value * y + at(i, j);
+			out[i] = value;
+		}
+	}
+
+	double evaluate(double x, double y) const {
+		double value = 0.0;
+		for (int i = degree_x; i >= 0; i--) {
+			double row_value = 0.0;
+			for (int j = degree_y; j >= 0; j--)
+				row_value = row_value * y + at(i, j);
+			value = value * x + row_value;
+		}
+		return value;
+	}
+};
+
+// Converts a tree built from +, -, *, constant divisors and constant integer powers of two variables
+// into coefficient form. Anything else, or a degree above max_degree, is rejected.
+class PolynomialExtractor {
+public:
+	static const int max_degree = 16;
+
+	bool extract(const ExprTree& tree, int x, int y, Polynomial& result) {
+		source = &tree;
+		x_variable = x;
+		y_variable = y;
+		memo.assign(tree.nodes.size(), nullptr);
+		return convert(tree.root, result);
+	}
+
+private:
+	const ExprTree* source = nullptr;
+	int x_variable = 0;
+	int y_variable = 1;
+	std::vector<std::shared_ptr<Polynomial>> memo;
+
+	static Polynomial add(const Polynomial& a, const Polynomial& b, double sign) {
+		Polynomial r;
+		r.degree_x = std::max(a.degree_x, b.degree_x);
+		r.degree_y = std::max(a.degree_y, b.degree_y);
+		r.coefficients.assign((r.degree_x + 1) * (r.degree_y + 1), 0.0);
+		for (int i = 0; i <= a.degree_x; i++)
+			for (int j = 0; j <= a.degree_y; j++)
+				r.at(i, j) += a.at(i, j);
+		for (int i = 0; i <= b.degree_x; i++)
+			for (int j = 0; j <= b.degree_y; j++)
+				r.at(i, j) += sign * b.at(i, j);
+		return r;
+	}
+
+	static bool multiply(const Polynomial& a, const Polynomial& b, Polynomial& r) {
+		r.degree_x = a.degree_x + b.degree_x;
+		r.degree_y = a.degree_y + b.degree_y;
+		if (r.degree_x > max_degree || r.degree_y > max_degree)
+			return false;
+		r.coefficients.assign((r.degree_x + 1) * (r.degree_y + 1), 0.0);
+		for (int i = 0; i <= a.degree_x; i++)
+			for (int j = 0; j <= a.degree_y; j++)
+				for (int k = 0; k <= b.degree_x; k++)
+					for (int l = 0; l <= b.degree_y; l++)
+						r.at(i + k, j + l) += a.at(i, j) * b.at(k, l);
+		return true;
+	}
+
+	static bool is_constant(const Polynomial& p) {
+		return p.degree_x == 0 && p.degree_y == 0;
+	}
+
+	bool convert(int node, Polynomial& result) {
+		if (memo[node]) {
+			result = *memo[node];
+			return true;
+		}
+
+		const ExprNode& n = source->nodes[node];
+		Polynomial a, b;
+		if (op_arity(n.op) > 0 && !convert(n.args[0], a))
+			return false;
+		if (op_arity(n.op) > 1 && !convert(n.args[1], b))
+			return false;
+
+		switch (n.op) {
+		case Op::Const:
+			result = Polynomial::constant(n.value);
+			break;
+		case Op::Var:
+			if (n.variable != x_variable && n.variable != y_variable)
+				return false;
+			result = Polynomial();
+			result.degree_x = n.variable == x_variable ? 1 : 0;
+			result.degree_y = n.variable == y_variable ? 1 : 0;
+			result.coefficients.assign((result.degree_x + 1) * (result.degree_y + 1), 0.0);
+			result.at(result.degree_x, result.degree_y) = 1.0;
+			break;
+		case Op::Neg: result = add(Polynomial::constant(0.0), a, -1.0); break;
+		case Op::Add: result = add(a, b, 1.0); break;
+		case Op::Sub: result = add(a, b, -1.0); break;
+		case Op::Mul:
+			if (!multiply(a, b, result))
+				return false;
+			break;
+		case Op::Div:
+			if (!is_constant(b) || b.coefficients[0] == 0.0)
+				return false;
+			result = a;
+			for (double& c : result.coefficients)
+				c /= b.coefficients[0];
+			break;
+		case Op::Pow: {
+			if (!is_constant(b))
+				return false;
+			const double exponent = b.coefficients[0];
+			if (exponent < 0.0 || exponent != std::floor(exponent) || exponent > max_degree)
+				return false;
+			result = Polynomial::constant(1.0);
+			for (int k = 0; k < static_cast<int>(exponent); k++) {
+				Polynomial product;
+				if (!multiply(result, a, product))
+					return false;
+				result = product;
+			}
+			break;
+		}
+		default:
+			return false;
+		}
+
+		memo[node] = std::make_shared<Polynomial>(result);
+		return true;
+	}
+};
+
+// A line of sample positions, with the start and step when they are evenly spaced.
+template <typename T>
+struct SampleAxis {
+	const T* samples = nullptr;
+	size_t count = 0;
+	bool uniform = false;
+	double start = 0.0;
+	double step = 0.0;
+};
+
+template <typename T>
+inline SampleAxis<T> make_axis(const T* samples, size_t count) {
+	SampleAxis<T> axis;
+	axis.samples = samples;
+	axis.count = count;
+	if (count < 2)
+		return axis;
+
+	axis.start = samples[0];
+	axis.step = (static_cast<double>(samples[count - 1]) - samples[0]) / (count - 1);
+	const double tolerance = 1e-2 * std::abs(axis.step);
+	axis.uniform = true;
+	for (size_t n = 0; n < count && axis.uniform; n++)
+		axis.uniform = std::abs(samples[n] - (axis.start + n * axis.step)) <= tolerance;
+	return axis;
+}
+
+// Samples between exact re-evaluations of the forward difference table. Rounding in the table grows
+// roughly with the step count to the power of the degree, so higher degrees refresh more often.
+inline size_t polynomial_refresh_interval(int degree) {
+	return std::max<size_t>(8, size_t(256) >> std::min(degree, 5));
+}
+
+// Evaluates a one-variable polynomial (lowest power first) at every sample of an axis. Evenly spaced
+// axes use forward differences, which take one addition per degree per sample; the table is rebuilt
+// from exact values periodically so accumulated rounding stays bounded.
+template <typename T>
+inline void evaluate_polynomial_line(const std::vector<double>& coefficients, const SampleAxis<T>& axis, T* out) {
+	const int degree = static_cast<int>(coefficients.size()) - 1;
+	auto horner = [&](double t) {
+		double value = 0.0;
+		for (int k = degree; k >= 0; k--)
+			value = value * t + coefficients[k];
+		return value;
+	};
+
+	if (!axis.uniform || degree < 1) {
+		for (size_t n = 0; n < axis.count; n++)
+			out[n] = static_cast<T>(horner(axis.samples[n]));
+		return;
+	}
+
+	const size_t refresh = polynomial_refresh_interval(degree);
+	double table[PolynomialExtractor::max_degree + 1];
+	for (size_t n = 0; n < axis.count; n++) {
+		if (n % refresh == 0) {
+			for (int k = 0; k <= degree; k++)
+				table[k] = horner(axis.start + (n + k) * axis.step);
+			for (int order = 1; order <= degree; order++)
+				for (int k = degree; k >= order; k--)
+					table[k] -= table[k - 1];
+		}
+
+		out[n] = static_cast<T>(table[0]);
+		for (int k = 0; k < degree; k++)
+			table[k] += table[k + 1];
+	}
+}
+
+#endif // !POLYNOMIAL_H
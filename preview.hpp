@@ -0,0 +1,224 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "expression_cache.hpp"
+#include "function_library.hpp"
+#include "parameters.hpp"
+#include "simd_eval.hpp"
+
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Everything a preview needs from an equation, copied so the compiler thread never reads the UI's.
+struct PreviewRequest {
+	std::string text;
+	// source of the function library the text is compiled against
+	std::string library;
+	std::vector<Parameter> parameters;
+	bool is_3d = true;
+	float min_x = -25.0f;
+	float max_x = 25.0f;
+	float min_y = -25.0f;
+	float max_y = 25.0f;
+	float min_z = -std::numeric_limits<float>::infinity();
+	float max_z = std::numeric_limits<float>::infinity();
+	float colour[3] = { 1.0f, 0.5f, 0.2f };
+	MathAccuracy accuracy = MathAccuracy::Exact;
+	// Equation::generation when the request was made
+	unsigned int generation = 0;
+};
+
+struct PreviewResult {
+	// the text and generation of the request; the equation may have moved on since
+	std::string text;
+	unsigned int generation = 0;
+	bool valid = false;
+	std::string error;
+	// positions followed by colours, like Equation::points_vec_equation
+	std::vector<glm::vec3> vertices;
+};
+
+// The latest request and result of one equation. The UI thread writes the request and takes the
+// result; the compiler thread does the opposite. The lock is only held while they are copied.
+struct PreviewSlot {
+	std::mutex lock;
+	// set while the slot waits in the compiler's queue
+	bool queued = false;
+	PreviewRequest request;
+	bool ready = false;
+	PreviewResult result;
+};
+
+// Compiles equations as they are typed, on a thread of its own, and samples a coarse surface of
+// each one that compiles. Only the newest request of a slot is served, so fast typing never builds
+// up a backlog. The thread keeps its own function library and expression cache because neither is
+// safe to share with the UI thread.
+class PreviewCompiler {
+public:
+	// samples per axis of a 3D preview, and along x of a 2D one
+	static const int surface_resolution = 64;
+	static const int curve_resolution = 512;
+
+	PreviewCompiler() {
+		cache.set_library(&library);
+	}
+
+	~PreviewCompiler() {
+		{
+			std::lock_guard<std::mutex> guard(queue_lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		if (worker.joinable())
+			worker.join();
+	}
+
+	PreviewCompiler(const PreviewCompiler&) = delete;
+	PreviewCompiler& operator=(const PreviewCompiler&) = delete;
+
+	// Replaces the slot's pending request, queueing the slot unless it already waits.
+	void submit(const std::shared_ptr<PreviewSlot>& slot, const PreviewRequest& request) {
+		bool queue_slot;
+		{
+			std::lock_guard<std::mutex> guard(slot->lock);
+			slot->request = request;
+			queue_slot = !slot->queued;
+			slot->queued = true;
+		}
+		if (!queue_slot)
+			return;
+
+		{
+			std::lock_guard<std::mutex> guard(queue_lock);
+			queue.push_back(slot);
+			if (!worker.joinable())
+				worker = std::thread([this] { run(); });
+		}
+		wake.notify_one();
+	}
+
+	// Moves a finished result out of the slot. Returns false when there is none.
+	static bool take(PreviewSlot& slot, PreviewResult& result) {
+		std::lock_guard<std::mutex> guard(slot.lock);
+		if (!slot.ready)
+			return false;
+		result = std::move(slot.result);
+		slot.ready = false;
+		return true;
+	}
+
+private:
+	FunctionLibrary library;
+	std::string library_source;
+	ExpressionCache<float> cache;
+
+	std::thread worker;
+	std::mutex queue_lock;
+	std::condition_variable wake;
+	std::deque<std::shared_ptr<PreviewSlot>> queue;
+	bool stopping = false;
+
+	void run() {
+		for (;;) {
+			std::shared_ptr<PreviewSlot> slot;
+			{
+				std::unique_lock<std::mutex> guard(queue_lock);
+				wake.wait(guard, [this] { return stopping || !queue.empty(); });
+				if (stopping)
+					return;
+				slot = queue.front();
+				queue.pop_front();
+			}
+
+			PreviewRequest request;
+			{
+				std::lock_guard<std::mutex> guard(slot->lock);
+				request = slot->request;
+				slot->queued = false;
+			}
+
+			PreviewResult result = build(request);
+			std::lock_guard<std::mutex> guard(slot->lock);
+			slot->result = std::move(result);
+			slot->ready = true;
+		}
+	}
+
+	PreviewResult build(const PreviewRequest& request) {
+		if (request.library != library_source) {
+			library.define(request.library);
+			library_source = request.library;
+		}
+
+		PreviewResult result;
+		result.text = request.text;
+		result.generation = request.generation;
+
+		// parameters typed since the last generation start at the value a new slider would have
+		std::vector<std::string> variables = { "x", "y", "z" };
+		std::vector<double> values;
+		for (const std::string& name : library.free_symbols(request.text, variables)) {
+			variables.push_back(name);
+			double value = 1.0;
+			for (const Parameter& parameter : request.parameters) {
+				if (parameter.name == name)
+					value = parameter.value;
+			}
+			values.push_back(value);
+		}
+
+		std::shared_ptr<CompiledExpression<float>> compiled = cache.get(request.text, variables);
+		if (!compiled->valid) {
+			result.error = compiled->error;
+			return result;
+		}
+		compiled->set_parameters(values);
+		result.valid = true;
+
+		const size_t cols = request.is_3d ? surface_resolution : curve_resolution;
+		const size_t rows = request.is_3d ? surface_resolution : 1;
+		std::vector<float> x_samples(cols * rows), y_samples(cols * rows, 0.0f), z_samples(cols * rows, 0.0f);
+		for (size_t i = 0; i < cols; i++) {
+			for (size_t j = 0; j < rows; j++) {
+				x_samples[i * rows + j] = request.min_x + (request.max_x - request.min_x) * i / (cols - 1);
+				if (rows > 1)
+					y_samples[i * rows + j] = request.min_y + (request.max_y - request.min_y) * j / (rows - 1);
+			}
+		}
+
+		std::vector<float> heights(cols * rows);
+		if (compiled->program) {
+			// the parameters are bound into the program as constants
+			const float* inputs[] = { x_samples.data(), y_samples.data(), z_samples.data() };
+			evaluate_batch(*compiled->program, inputs, heights.data(), heights.size(), request.accuracy);
+		}
+		else {
+			for (size_t k = 0; k < heights.size(); k++) {
+				compiled->variable(0) = x_samples[k];
+				compiled->variable(1) = y_samples[k];
+				heights[k] = compiled->value();
+			}
+		}
+
+		const glm::vec3 colour(request.colour[0], request.colour[1], request.colour[2]);
+		for (size_t k = 0; k < heights.size(); k++) {
+			const float z = heights[k];
+			if (!std::isfinite(z) || z < request.min_z || z > request.max_z)
+				continue;
+			result.vertices.emplace_back(x_samples[k], z, y_samples[k]);
+			result.vertices.push_back(colour);
+		}
+		return result;
+	}
+};
+
+#endif // !PREVIEW_H
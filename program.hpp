@@ -0,0 +1,334 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "expression_tree.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Register bytecode for an ExprTree. Registers [0, inputs) hold the input variables and the next
+// constants.size() registers hold constants. lower_program() gives every instruction its own
+// register; compile_program() then fuses and packs them into a small reusable register file.
+struct Instruction {
+	Op op;
+	uint16_t dst;
+	uint16_t a;
+	uint16_t b;
+	uint16_t c;
+};
+
+struct Program {
+	std::vector<std::string> inputs;
+	std::vector<double> constants;
+	std::vector<Instruction> code;
+	uint16_t result = 0;
+	// one register per root the program was lowered from; result is the first of them
+	std::vector<uint16_t> results;
+	size_t register_count = 0;
+
+	size_t first_constant() const {
+		return inputs.size();
+	}
+};
+
+template <typename T>
+inline T epsilon_for() {
+	return std::is_same<T, float>::value ? T(0.000001) : T(0.0000000001);
+}
+
+// Scalar semantics of every operation, matching exprtk's real_type implementations.
+template <typename T>
+inline T apply_op(Op op, T a, T b = T(0), T c = T(0)) {
+	switch (op) {
+	case Op::Neg: return -a;
+	case Op::Add: return a + b;
+	case Op::Sub: return a - b;
+	case Op::Mul: return a * b;
+	case Op::Div: return a / b;
+	case Op::Mod: return std::fmod(a, b);
+	case Op::Pow: return std::pow(a, b);
+	case Op::Lt: return a < b ? T(1) : T(0);
+	case Op::Le: return a <= b ? T(1) : T(0);
+	case Op::Gt: return a > b ? T(1) : T(0);
+	case Op::Ge: return a >= b ? T(1) : T(0);
+	case Op::Eq: return std::abs(a - b) <= std::max(T(1), std::max(std::abs(a), std::abs(b))) * epsilon_for<T>() ? T(1) : T(0);
+	case Op::Ne: return std::abs(a - b) > std::max(T(1), std::max(std::abs(a), std::abs(b))) * epsilon_for<T>() ? T(1) : T(0);
+	case Op::And: return (a != T(0) && b != T(0)) ? T(1) : T(0);
+	case Op::Or: return (a != T(0) || b != T(0)) ? T(1) : T(0);
+	case Op::Not: return a != T(0) ? T(0) : T(1);
+	case Op::Select: return a != T(0) ? b : c;
+	case Op::Min: return std::min(a, b);
+	case Op::Max: return std::max(a, b);
+	case Op::Atan2: return std::atan2(a, b);
+	case Op::Hypot: return std::sqrt(a * a + b * b);
+	case Op::Abs: return std::abs(a);
+	case Op::Sqrt: return std::sqrt(a);
+	case Op::Exp: return std::exp(a);
+	case Op::Log: return std::log(a);
+	case Op::Log10: return std::log10(a);
+	case Op::Log2: return std::log2(a);
+	case Op::Sin: return std::sin(a);
+	case Op::Cos: return std::cos(a);
+	case Op::Tan: return std::tan(a);
+	case Op::Asin: return std::asin(a);
+	case Op::Acos: return std::acos(a);
+	case Op::Atan: return std::atan(a);
+	case Op::Sinh: return std::sinh(a);
+	case Op::Cosh: return std::cosh(a);
+	case Op::Tanh: return std::tanh(a);
+	case Op::Floor: return std::floor(a);
+	case Op::Ceil: return std::ceil(a);
+	case Op::Round: return a < T(0) ? std::ceil(a - T(0.5)) : std::floor(a + T(0.5));
+	case Op::Trunc: return std::trunc(a);
+	case Op::Sgn: return a > T(0) ? T(1) : (a < T(0) ? T(-1) : T(0));
+	case Op::MulAdd: return a * b + c;
+	case Op::Square: return a * a;
+	case Op::SumSquares: return a * a + b * b;
+	default: return std::numeric_limits<T>::quiet_NaN();
+	}
+}
+
+// Lowers every node reachable from roots, so nodes shared between roots are evaluated once.
+inline bool lower_program(const ExprTree& tree, const std::vector<int>& roots, Program& program) {
+	program = Program();
+	program.inputs = tree.variables;
+
+	std::vector<int> order;
+	std::vector<char> visited(tree.nodes.size(), 0);
+	std::vector<int> stack(roots.rbegin(), roots.rend());
+	while (!stack.empty()) {
+		const int node = stack.back();
+		if (visited[node] == 2) {
+			stack.pop_back();
+			continue;
+		}
+		if (visited[node] == 1) {
+			visited[node] = 2;
+			order.push_back(node);
+			stack.pop_back();
+			continue;
+		}
+		visited[node] = 1;
+		for (int i = 0; i < op_arity(tree.nodes[node].op); i++) {
+			if (!visited[tree.nodes[node].args[i]])
+				stack.push_back(tree.nodes[node].args[i]);
+		}
+	}
+
+	// constants stay in double so double evaluation keeps their precision
+	auto constant_bits = [](double value) {
+		uint64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	};
+
+	std::unordered_map<uint64_t, uint16_t> constant_registers;
+	std::vector<double> constants;
+	for (int node : order) {
+		if (tree.nodes[node].op != Op::Const)
+			continue;
+		const uint64_t bits = constant_bits(tree.nodes[node].value);
+		if (constant_registers.count(bits) == 0) {
+			constant_registers[bits] = static_cast<uint16_t>(constants.size());
+			constants.push_back(tree.nodes[node].value);
+		}
+	}
+
+	const size_t limit = std::numeric_limits<uint16_t>::max();
+	if (program.inputs.size() + constants.size() + order.size() >= limit)
+		return false;
+
+	program.constants = constants;
+	size_t next_register = program.inputs.size() + constants.size();
+
+	std::vector<uint16_t> node_register(tree.nodes.size(), 0);
+	for (int node : order) {
+		const ExprNode& n = tree.nodes[node];
+		if (n.op == Op::Const) {
+			node_register[node] = static_cast<uint16_t>(program.first_constant() + constant_registers[constant_bits(n.value)]);
+			continue;
+		}
+		if (n.op == Op::Var) {
+			node_register[node] = static_cast<uint16_t>(n.variable);
+			continue;
+		}
+
+		Instruction instruction = { n.op, static_cast<uint16_t>(next_register++), 0, 0, 0 };
+		const int arity = op_arity(n.op);
+		if (arity > 0) instruction.a = node_register[n.args[0]];
+		if (arity > 1) instruction.b = node_register[n.args[1]];
+		if (arity > 2) instruction.c = node_register[n.args[2]];
+		node_register[node] = instruction.dst;
+		program.code.push_back(instruction);
+	}
+
+	for (int root : roots)
+		program.results.push_back(node_register[root]);
+	program.result = program.results[0];
+	program.register_count = next_register;
+	return true;
+}
+
+inline bool lower_program(const ExprTree& tree, Program& program) {
+	return lower_program(tree, std::vector<int>{ tree.root }, program);
+}
+
+inline void for_each_operand(Instruction& ins, const std::function<void(uint16_t&)>& func) {
+	const int arity = op_arity(ins.op);
+	if (arity > 0) func(ins.a);
+	if (arity > 1) func(ins.b);
+	if (arity > 2) func(ins.c);
+}
+
+// Rewrites single-use products feeding an addition into superinstructions. Expects the SSA form
+// produced by lower_program, so it has to run before allocate_registers.
+inline void fuse_instructions(Program& program) {
+	std::vector<int> uses(program.register_count, 0);
+	std::vector<int> producer(program.register_count, -1);
+	for (size_t i = 0; i < program.code.size(); i++) {
+		Instruction& ins = program.code[i];
+		if (ins.op == Op::Mul && ins.a == ins.b)
+			ins = { Op::Square, ins.dst, ins.a, 0, 0 };
+		for_each_operand(ins, [&](uint16_t& reg) { uses[reg]++; });
+		producer[ins.dst] = static_cast<int>(i);
+	}
+	for (uint16_t result : program.results)
+		uses[result]++;
+
+	std::vector<char> dead(program.code.size(), 0);
+	auto single_use = [&](uint16_t reg, Op op) {
+		return producer[reg] >= 0 && uses[reg] == 1 && program.code[producer[reg]].op == op;
+	};
+
+	for (Instruction& ins : program.code) {
+		if (ins.op != Op::Add)
+			continue;
+
+		if (single_use(ins.a, Op::Square) && single_use(ins.b, Op::Square)) {
+			dead[producer[ins.a]] = dead[producer[ins.b]] = 1;
+			ins = { Op::SumSquares, ins.dst, program.code[producer[ins.a]].a, program.code[producer[ins.b]].a, 0 };
+		}
+		else if (single_use(ins.a, Op::Mul) || single_use(ins.a, Op::Square)) {
+			const Instruction& product = program.code[producer[ins.a]];
+			dead[producer[ins.a]] = 1;
+			ins = { Op::MulAdd, ins.dst, product.a, product.op == Op::Square ? product.a : product.b, ins.b };
+		}
+		else if (single_use(ins.b, Op::Mul) || single_use(ins.b, Op::Square)) {
+			const Instruction& product = program.code[producer[ins.b]];
+			dead[producer[ins.b]] = 1;
+			ins = { Op::MulAdd, ins.dst, product.a, product.op == Op::Square ? product.a : product.b, ins.a };
+		}
+	}
+
+	std::vector<Instruction> code;
+	for (size_t i = 0; i < program.code.size(); i++) {
+		if (!dead[i])
+			code.push_back(program.code[i]);
+	}
+	program.code = code;
+}
+
+// Maps SSA registers onto a small register file by reusing a register once its last reader has run.
+// Every operation reads its operands before writing, so an instruction may reuse one of its inputs.
+inline void allocate_registers(Program& program) {
+	const size_t fixed = program.inputs.size() + program.constants.size();
+
+	std::vector<size_t> last_use(program.register_count, 0);
+	for (size_t i = 0; i < program.code.size(); i++) {
+		for_each_operand(program.code[i], [&](uint16_t& reg) { last_use[reg] = i; });
+	}
+	for (uint16_t result : program.results)
+		last_use[result] = program.code.size();
+
+	std::vector<uint16_t> mapping(program.register_count);
+	for (size_t reg = 0; reg < fixed; reg++)
+		mapping[reg] = static_cast<uint16_t>(reg);
+
+	std::vector<uint16_t> free_registers;
+	size_t register_count = fixed;
+
+	for (size_t i = 0; i < program.code.size(); i++) {
+		Instruction& ins = program.code[i];
+		for_each_operand(ins, [&](uint16_t& reg) {
+			const uint16_t ssa = reg;
+			reg = mapping[ssa];
+			if (ssa >= fixed && last_use[ssa] == i) {
+				free_registers.push_back(reg);
+				last_use[ssa] = program.code.size() + 1;
+			}
+		});
+
+		uint16_t physical;
+		if (!free_registers.empty()) {
+			physical = free_registers.back();
+			free_registers.pop_back();
+		}
+		else {
+			physical = static_cast<uint16_t>(register_count++);
+		}
+
+		const uint16_t ssa = ins.dst;
+		mapping[ssa] = physical;
+		ins.dst = physical;
+		if (last_use[ssa] == 0)
+			free_registers.push_back(physical);
+	}
+
+	for (uint16_t& result : program.results)
+		result = mapping[result];
+	program.result = program.results[0];
+	program.register_count = register_count;
+}
+
+// Turns inputs [first, first + values.size()) into constants holding values. Registers are renumbered
+// so the result keeps the usual layout of inputs, then constants, then temporaries.
+inline Program bind_inputs(const Program& program, size_t first, const std::vector<double>& values) {
+	const size_t bound = values.size();
+	const size_t fixed = program.inputs.size() + program.constants.size();
+	auto map = [&](uint16_t& reg) {
+		if (reg < first)
+			return;
+		if (reg < first + bound)
+			reg = static_cast<uint16_t>(fixed - bound + (reg - first));
+		else if (reg < fixed)
+			reg = static_cast<uint16_t>(reg - bound);
+	};
+
+	Program result = program;
+	result.inputs.erase(result.inputs.begin() + first, result.inputs.begin() + first + bound);
+	result.constants.insert(result.constants.end(), values.begin(), values.end());
+	for (Instruction& ins : result.code) {
+		map(ins.dst);
+		for_each_operand(ins, map);
+	}
+	map(result.result);
+	for (uint16_t& reg : result.results)
+		map(reg);
+	return result;
+}
+
+inline bool compile_program(const ExprTree& tree, const std::vector<int>& roots, Program& program) {
+	if (!lower_program(tree, roots, program))
+		return false;
+	fuse_instructions(program);
+	allocate_registers(program);
+	return true;
+}
+
+inline bool compile_program(const ExprTree& tree, Program& program) {
+	if (!lower_program(tree, program))
+		return false;
+	fuse_instructions(program);
+	allocate_registers(program);
+	return true;
+}
+
+#endif // !PROGRAM_H
@@ -0,0 +1,170 @@
+#ifndef SEPARABLE_H
+#define SEPARABLE_H
+
+#include "expression_tree.hpp"
+
+#include <cstdint>
+#include <vector>
+
+enum class Separation { None, Sum, Product };
+
+// f(x, y) written as x_part(x) + y_part(y) or x_part(x) * y_part(y). Both parts keep the variables
+// of the source tree, so they compile against the same inputs.
+struct SeparableForm {
+	Separation kind = Separation::None;
+	ExprTree x_part;
+	ExprTree y_part;
+};
+
+// Splits sums and products of terms that each depend on only one of two variables. Sums flatten
+// through +, - and negation, products through *, / and negation; constants join the x part.
+class SeparabilityAnalyzer {
+public:
+	bool analyze(const ExprTree& tree, int x, int y, SeparableForm& form) {
+		source = &tree;
+		masks.assign(tree.nodes.size(), 0);
+		computed.assign(tree.nodes.size(), 0);
+		x_mask = uint64_t(1) << x;
+		y_mask = uint64_t(1) << y;
+
+		const uint64_t root_mask = mask(tree.root);
+		if (!(root_mask & x_mask) || !(root_mask & y_mask))
+			return false;
+
+		std::vector<Term> terms;
+		bool negative = false;
+		collect(tree.root, false, Separation::Sum, terms, negative);
+		if (split(terms, Separation::Sum, false, form))
+			return true;
+
+		terms.clear();
+		negative = false;
+		collect(tree.root, false, Separation::Product, terms, negative);
+		return split(terms, Separation::Product, negative, form);
+	}
+
+private:
+	struct Term {
+		int node;
+		bool inverted;  // subtracted for sums, divided for products
+	};
+
+	const ExprTree* source = nullptr;
+	std::vector<uint64_t> masks;
+	std::vector<char> computed;
+	uint64_t x_mask = 0;
+	uint64_t y_mask = 0;
+
+	uint64_t mask(int node) {
+		if (computed[node])
+			return masks[node];
+
+		const ExprNode& n = source->nodes[node];
+		uint64_t result = n.op == Op::Var ? uint64_t(1) << n.variable : 0;
+		for (int i = 0; i < op_arity(n.op); i++)
+			result |= mask(n.args[i]);
+
+		computed[node] = 1;
+		masks[node] = result;
+		return result;
+	}
+
+	void collect(int node, bool inverted, Separation kind, std::vector<Term>& terms, bool& negative) {
+		const ExprNode& n = source->nodes[node];
+		if (kind == Separation::Sum && (n.op == Op::Add || n.op == Op::Sub)) {
+			collect(n.args[0], inverted, kind, terms, negative);
+			collect(n.args[1], n.op == Op::Sub ? !inverted : inverted, kind, terms, negative);
+		}
+		else if (kind == Separation::Product && (n.op == Op::Mul || n.op == Op::Div)) {
+			collect(n.args[0], inverted, kind, terms, negative);
+			collect(n.args[1], n.op == Op::Div ? !inverted : inverted, kind, terms, negative);
+		}
+		else if (n.op == Op::Neg) {
+			if (kind == Separation::Sum) {
+				collect(n.args[0], !inverted, kind, terms, negative);
+			}
+			else {
+				negative = !negative;
+				collect(n.args[0], inverted, kind, terms, negative);
+			}
+		}
+		else {
+			terms.push_back({ node, inverted });
+		}
+	}
+
+	int copy(int node, ExprTree& to, std::vector<int>& copied) {
+		if (copied[node] >= 0)
+			return copied[node];
+
+		ExprNode n = source->nodes[node];
+		for (int i = 0; i < op_arity(n.op); i++)
+			n.args[i] = copy(n.args[i], to, copied);
+
+		copied[node] = to.add(n);
+		return copied[node];
+	}
+
+	int build(const std::vector<Term>& terms, Separation kind, ExprTree& to) {
+		std::vector<int> copied(source->nodes.size(), -1);
+		const Op join = kind == Separation::Sum ? Op::Add : Op::Mul;
+		const Op inverse = kind == Separation::Sum ? Op::Sub : Op::Div;
+
+		int result = -1;
+		for (const Term& term : terms) {
+			if (!term.inverted)
+				result = result < 0 ? copy(term.node, to, copied) : to.binary(join, result, copy(term.node, to, copied));
+		}
+		for (const Term& term : terms) {
+			if (!term.inverted)
+				continue;
+			if (result < 0)
+				result = kind == Separation::Sum ? to.unary(Op::Neg, copy(term.node, to, copied)) : to.binary(Op::Div, to.constant(1.0), copy(term.node, to, copied));
+			else
+				result = to.binary(inverse, result, copy(term.node, to, copied));
+		}
+		return result;
+	}
+
+	bool split(const std::vector<Term>& terms, Separation kind, bool negative, SeparableForm& form) {
+		std::vector<Term> x_terms;
+		std::vector<Term> y_terms;
+		for (const Term& term : terms) {
+			const uint64_t m = mask(term.node);
+			if ((m & ~x_mask) == 0)
+				x_terms.push_back(term);
+			else if ((m & ~y_mask) == 0)
+				y_terms.push_back(term);
+			else
+				return false;
+		}
+
+		form = SeparableForm();
+		form.kind = kind;
+		form.x_part.variables = form.y_part.variables = source->variables;
+		form.x_part.root = build(x_terms, kind, form.x_part);
+		form.y_part.root = build(y_terms, kind, form.y_part);
+		if (negative)
+			form.x_part.root = form.x_part.unary(Op::Neg, form.x_part.root);
+		return true;
+	}
+};
+
+// out[i * rows + j] = fx[i] (+ or *) gy[j], laid out like the 3D height grid.
+template <typename T>
+inline void combine_outer(Separation kind, const T* fx, size_t cols, const T* gy, size_t rows, T* out) {
+	for (size_t i = 0; i < cols; i++) {
+		const T a = fx[i];
+		T* column = out + i * rows;
+		if (kind == Separation::Sum) {
+			for (size_t j = 0; j < rows; j++)
+				column[j] = a + gy[j];
+		}
+		else {
+			for (size_t j = 0; j < rows; j++)
+				column[j] = a * gy[j];
+		}
+	}
+}
+
+#endif // !SEPARABLE_H
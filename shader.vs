@@ -1,11 +1,13 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aColor;
+layout (location = 2) in float aHeight;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 uniform float point_size;
+uniform bool use_sweep;
 
 out vec3 ourColor;
 out float heightY;
@@ -14,8 +16,14 @@ void main()
 {
     ourColor = aColor;
     gl_PointSize = point_size;
-    vec4 worldPos = model * vec4(aPos, 1.0);
+    vec3 position = aPos;
+    if (use_sweep)
+        position.y = aHeight;
+    vec4 worldPos = model * vec4(position, 1.0);
     heightY = worldPos.y;
     gl_Position = projection * view * worldPos;
+    // missing samples of a sweep frame are moved outside the clip volume
+    if (use_sweep && isnan(aHeight))
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
     
 }
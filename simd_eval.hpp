@@ -0,0 +1,369 @@
+#ifndef SIMD_EVAL_H
+#define SIMD_EVAL_H
+
+#include "program.hpp"
+#include "vm.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PLANAR_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define PLANAR_SIMD_X86 0
+#endif
+
+enum class SimdLevel {
+	Scalar,
+	SSE41,
+	AVX2,
+	AVX512,
+};
+
+inline const char* simd_level_name(SimdLevel level) {
+	switch (level) {
+	case SimdLevel::SSE41: return "SSE4.1";
+	case SimdLevel::AVX2: return "AVX2";
+	case SimdLevel::AVX512: return "AVX-512";
+	default: return "Scalar";
+	}
+}
+
+// How sin, cos, exp, log and pow are computed by the vector kernels, named after the error each
+// tier keeps to. Approximate and Close use polynomial approximations evaluated on whole vectors:
+// Close stays within 2 ulp and leaves pow to libm; Approximate stays within 3 ulp except for pow,
+// which can be off by around a hundred. Exact calls libm lane by lane and is the default.
+enum class MathAccuracy {
+	Approximate,
+	Close,
+	Exact,
+};
+
+inline const char* math_accuracy_name(MathAccuracy accuracy) {
+	switch (accuracy) {
+	case MathAccuracy::Approximate: return "Approximate";
+	case MathAccuracy::Close: return "Within 2 ulp";
+	default: return "Exact";
+	}
+}
+
+inline SimdLevel detect_simd_level() {
+#if PLANAR_SIMD_X86
+	auto cpuid = [](int leaf, int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuidex(info, leaf, subleaf);
+		for (int i = 0; i < 4; i++)
+			regs[i] = static_cast<unsigned int>(info[i]);
+#else
+		__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	};
+
+	unsigned int regs[4];
+	cpuid(0, 0, regs);
+	const unsigned int max_leaf = regs[0];
+
+	cpuid(1, 0, regs);
+	const bool sse41 = (regs[2] & (1u << 19)) != 0;
+	const bool fma = (regs[2] & (1u << 12)) != 0;
+	const bool osxsave = (regs[2] & (1u << 27)) != 0;
+	const bool avx = (regs[2] & (1u << 28)) != 0;
+
+	unsigned long long xcr0 = 0;
+	if (osxsave) {
+#if defined(_MSC_VER)
+		xcr0 = _xgetbv(0);
+#else
+		unsigned int lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		xcr0 = (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+	}
+	const bool ymm_enabled = (xcr0 & 0x6) == 0x6;
+	const bool zmm_enabled = (xcr0 & 0xe6) == 0xe6;
+
+	bool avx2 = false;
+	bool avx512 = false;
+	if (max_leaf >= 7) {
+		cpuid(7, 0, regs);
+		avx2 = (regs[1] & (1u << 5)) != 0;
+		avx512 = (regs[1] & (1u << 16)) != 0;
+	}
+
+	if (avx512 && zmm_enabled)
+		return SimdLevel::AVX512;
+	if (avx && avx2 && fma && ymm_enabled)
+		return SimdLevel::AVX2;
+	if (sse41)
+		return SimdLevel::SSE41;
+#endif
+	return SimdLevel::Scalar;
+}
+
+inline SimdLevel supported_simd_level() {
+	static const SimdLevel level = detect_simd_level();
+	return level;
+}
+
+// Lanes evaluated per instruction dispatch. A multiple of every vector width below.
+const size_t simd_block_lanes = 64;
+
+namespace simd_scalar {
+	struct V {
+		static const size_t width = 1;
+		typedef float reg;
+
+		static reg load(const float* p) { return *p; }
+		static void store(float* p, reg v) { *p = v; }
+		static reg set1(float v) { return v; }
+		static reg add(reg a, reg b) { return a + b; }
+		static reg sub(reg a, reg b) { return a - b; }
+		static reg mul(reg a, reg b) { return a * b; }
+		static reg div(reg a, reg b) { return a / b; }
+		static reg muladd(reg a, reg b, reg c) { return a * b + c; }
+		static reg min(reg a, reg b) { return std::min(a, b); }
+		static reg max(reg a, reg b) { return std::max(a, b); }
+		static reg neg(reg a) { return -a; }
+		static reg abs(reg a) { return std::abs(a); }
+		static reg sqrt(reg a) { return std::sqrt(a); }
+		static reg floor(reg a) { return std::floor(a); }
+		static reg ceil(reg a) { return std::ceil(a); }
+		static reg trunc(reg a) { return std::trunc(a); }
+		static reg lt(reg a, reg b, reg one) { return a < b ? one : 0.0f; }
+		static reg le(reg a, reg b, reg one) { return a <= b ? one : 0.0f; }
+		static reg truth(reg a, reg zero, reg one) { return a != zero ? one : 0.0f; }
+		static reg select(reg c, reg a, reg b, reg zero) { return c != zero ? a : b; }
+		static reg pow2i(reg n) { return n == n ? std::ldexp(1.0f, static_cast<int>(n)) : n; }
+		static reg frexp(reg a, reg& e) {
+			int exponent = 0;
+			const float m = std::frexp(a, &exponent);
+			e = static_cast<float>(exponent);
+			return m;
+		}
+	};
+
+#include "vector_math.inl"
+#include "simd_kernels.inl"
+}
+
+#if PLANAR_SIMD_X86
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse4.1"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#endif
+
+namespace simd_sse41 {
+	struct V {
+		static const size_t width = 4;
+		typedef __m128 reg;
+
+		static reg load(const float* p) { return _mm_loadu_ps(p); }
+		static void store(float* p, reg v) { _mm_storeu_ps(p, v); }
+		static reg set1(float v) { return _mm_set1_ps(v); }
+		static reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+		static reg sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+		static reg mul(reg a, reg b) { return _mm_mul_ps(a, b); }
+		static reg div(reg a, reg b) { return _mm_div_ps(a, b); }
+		static reg muladd(reg a, reg b, reg c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+		// operands swapped so NaN handling matches std::min / std::max
+		static reg min(reg a, reg b) { return _mm_min_ps(b, a); }
+		static reg max(reg a, reg b) { return _mm_max_ps(b, a); }
+		static reg neg(reg a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+		static reg abs(reg a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+		static reg sqrt(reg a) { return _mm_sqrt_ps(a); }
+		static reg floor(reg a) { return _mm_floor_ps(a); }
+		static reg ceil(reg a) { return _mm_ceil_ps(a); }
+		static reg trunc(reg a) { return _mm_round_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+		static reg lt(reg a, reg b, reg one) { return _mm_and_ps(_mm_cmplt_ps(a, b), one); }
+		static reg le(reg a, reg b, reg one) { return _mm_and_ps(_mm_cmple_ps(a, b), one); }
+		static reg truth(reg a, reg zero, reg one) { return _mm_and_ps(_mm_cmpneq_ps(a, zero), one); }
+		static reg select(reg c, reg a, reg b, reg zero) { return _mm_blendv_ps(b, a, _mm_cmpneq_ps(c, zero)); }
+		// 2^n for integral n in [-126, 127]
+		static reg pow2i(reg n) { return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23)); }
+		// mantissa in [0.5, 1) and exponent of positive normal numbers
+		static reg frexp(reg a, reg& e) {
+			const __m128i bits = _mm_castps_si128(a);
+			e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(126)));
+			return _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x807fffff)), _mm_set1_epi32(0x3f000000)));
+		}
+	};
+
+#include "vector_math.inl"
+#include "simd_kernels.inl"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+namespace simd_avx2 {
+	struct V {
+		static const size_t width = 8;
+		typedef __m256 reg;
+
+		static reg load(const float* p) { return _mm256_loadu_ps(p); }
+		static void store(float* p, reg v) { _mm256_storeu_ps(p, v); }
+		static reg set1(float v) { return _mm256_set1_ps(v); }
+		static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+		static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+		static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+		static reg div(reg a, reg b) { return _mm256_div_ps(a, b); }
+		static reg muladd(reg a, reg b, reg c) { return _mm256_fmadd_ps(a, b, c); }
+		static reg min(reg a, reg b) { return _mm256_min_ps(b, a); }
+		static reg max(reg a, reg b) { return _mm256_max_ps(b, a); }
+		static reg neg(reg a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+		static reg abs(reg a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+		static reg sqrt(reg a) { return _mm256_sqrt_ps(a); }
+		static reg floor(reg a) { return _mm256_floor_ps(a); }
+		static reg ceil(reg a) { return _mm256_ceil_ps(a); }
+		static reg trunc(reg a) { return _mm256_round_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+		static reg lt(reg a, reg b, reg one) { return _mm256_and_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ), one); }
+		static reg le(reg a, reg b, reg one) { return _mm256_and_ps(_mm256_cmp_ps(a, b, _CMP_LE_OQ), one); }
+		static reg truth(reg a, reg zero, reg one) { return _mm256_and_ps(_mm256_cmp_ps(a, zero, _CMP_NEQ_UQ), one); }
+		static reg select(reg c, reg a, reg b, reg zero) { return _mm256_blendv_ps(b, a, _mm256_cmp_ps(c, zero, _CMP_NEQ_UQ)); }
+		static reg pow2i(reg n) { return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23)); }
+		static reg frexp(reg a, reg& e) {
+			const __m256i bits = _mm256_castps_si256(a);
+			e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+			return _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x807fffff)), _mm256_set1_epi32(0x3f000000)));
+		}
+	};
+
+#include "vector_math.inl"
+#include "simd_kernels.inl"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+
+namespace simd_avx512 {
+	struct V {
+		static const size_t width = 16;
+		typedef __m512 reg;
+
+		static reg load(const float* p) { return _mm512_loadu_ps(p); }
+		static void store(float* p, reg v) { _mm512_storeu_ps(p, v); }
+		static reg set1(float v) { return _mm512_set1_ps(v); }
+		static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+		static reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+		static reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+		static reg div(reg a, reg b) { return _mm512_div_ps(a, b); }
+		static reg muladd(reg a, reg b, reg c) { return _mm512_fmadd_ps(a, b, c); }
+		static reg min(reg a, reg b) { return _mm512_min_ps(b, a); }
+		static reg max(reg a, reg b) { return _mm512_max_ps(b, a); }
+		static reg neg(reg a) { return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a), _mm512_set1_epi32(static_cast<int>(0x80000000u)))); }
+		static reg abs(reg a) { return _mm512_abs_ps(a); }
+		static reg sqrt(reg a) { return _mm512_sqrt_ps(a); }
+		static reg floor(reg a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+		static reg ceil(reg a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC); }
+		static reg trunc(reg a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+		static reg lt(reg a, reg b, reg one) { return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(a, b, _CMP_LT_OQ), one); }
+		static reg le(reg a, reg b, reg one) { return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(a, b, _CMP_LE_OQ), one); }
+		static reg truth(reg a, reg zero, reg one) { return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(a, zero, _CMP_NEQ_UQ), one); }
+		static reg select(reg c, reg a, reg b, reg zero) { return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(c, zero, _CMP_NEQ_UQ), b, a); }
+		static reg pow2i(reg n) { return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23)); }
+		static reg frexp(reg a, reg& e) {
+			const __m512i bits = _mm512_castps_si512(a);
+			e = _mm512_cvtepi32_ps(_mm512_sub_epi32(_mm512_srli_epi32(bits, 23), _mm512_set1_epi32(126)));
+			return _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x807fffff)), _mm512_set1_epi32(0x3f000000)));
+		}
+	};
+
+#include "vector_math.inl"
+#include "simd_kernels.inl"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
+
+// Evaluates program for count lanes. inputs holds one array per program input.
+// level is clamped to what the CPU supports; by default the widest supported set is used.
+inline void evaluate_batch(const Program& program, const float* const* inputs, float* out, size_t count,
+	MathAccuracy accuracy = MathAccuracy::Exact, SimdLevel level = supported_simd_level()) {
+	level = std::min(level, supported_simd_level());
+	switch (level) {
+#if PLANAR_SIMD_X86
+	case SimdLevel::AVX512: simd_avx512::evaluate(program, inputs, out, count, accuracy); break;
+	case SimdLevel::AVX2: simd_avx2::evaluate(program, inputs, out, count, accuracy); break;
+	case SimdLevel::SSE41: simd_sse41::evaluate(program, inputs, out, count, accuracy); break;
+#endif
+	default: simd_scalar::evaluate(program, inputs, out, count, accuracy); break;
+	}
+}
+
+// Like evaluate_batch, for programs lowered from several roots. outs holds one array per result.
+inline void evaluate_batch_outputs(const Program& program, const float* const* inputs, float* const* outs, size_t count,
+	MathAccuracy accuracy = MathAccuracy::Exact, SimdLevel level = supported_simd_level()) {
+	level = std::min(level, supported_simd_level());
+	switch (level) {
+#if PLANAR_SIMD_X86
+	case SimdLevel::AVX512: simd_avx512::evaluate_outputs(program, inputs, outs, count, accuracy); break;
+	case SimdLevel::AVX2: simd_avx2::evaluate_outputs(program, inputs, outs, count, accuracy); break;
+	case SimdLevel::SSE41: simd_sse41::evaluate_outputs(program, inputs, outs, count, accuracy); break;
+#endif
+	default: simd_scalar::evaluate_outputs(program, inputs, outs, count, accuracy); break;
+	}
+}
+
+// There are no vector kernels for double, so double batches run the scalar VM one sample at a time,
+// with libm whatever the accuracy.
+inline void evaluate_batch(const Program& program, const double* const* inputs, double* out, size_t count, MathAccuracy /* accuracy */ = MathAccuracy::Exact) {
+	thread_local std::vector<double> registers;
+	load_constants(program, registers);
+
+	for (size_t n = 0; n < count; n++) {
+		for (size_t i = 0; i < program.inputs.size(); i++)
+			registers[i] = inputs[i][n];
+		out[n] = run_program(program, registers.data());
+	}
+}
+
+inline void evaluate_batch_outputs(const Program& program, const double* const* inputs, double* const* outs, size_t count, MathAccuracy /* accuracy */ = MathAccuracy::Exact) {
+	thread_local std::vector<double> registers;
+	load_constants(program, registers);
+
+	for (size_t n = 0; n < count; n++) {
+		for (size_t i = 0; i < program.inputs.size(); i++)
+			registers[i] = inputs[i][n];
+		run_program(program, registers.data());
+		for (size_t i = 0; i < program.results.size(); i++)
+			outs[i][n] = registers[program.results[i]];
+	}
+}
+
+#endif // !SIMD_EVAL_H
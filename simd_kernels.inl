@@ -0,0 +1,163 @@
+// Batch kernels for one instruction set. simd_eval.hpp includes this file once per instruction set,
+// inside a namespace that defines V as that set's vector wrapper.
+
+#define PLANAR_SIMD_MAP(expr) for (size_t k = 0; k < simd_block_lanes; k += V::width) V::store(d + k, expr); break
+#define A V::load(a + k)
+#define B V::load(b + k)
+#define C V::load(c + k)
+
+// Arguments past this lose too much in reduce_quadrant(), so the close tier hands them to libm.
+const float trig_reduction_limit = 8192.0f;
+
+inline void run_block(const Program& program, float* registers, MathAccuracy accuracy) {
+	const V::reg one = V::set1(1.0f);
+	const V::reg half = V::set1(0.5f);
+	const V::reg zero = V::set1(0.0f);
+	const V::reg epsilon = V::set1(epsilon_for<float>());
+	const bool vector_math = accuracy != MathAccuracy::Exact;
+	const bool fast = accuracy == MathAccuracy::Approximate;
+	// lanes the close tier hands to libm, with their arguments
+	size_t large_lanes[simd_block_lanes];
+	float large_arguments[simd_block_lanes];
+
+	for (const Instruction& ins : program.code) {
+		float* d = registers + ins.dst * simd_block_lanes;
+		const float* a = registers + ins.a * simd_block_lanes;
+		const float* b = registers + ins.b * simd_block_lanes;
+		const float* c = registers + ins.c * simd_block_lanes;
+
+		auto apply_scalar = [&] {
+			for (size_t k = 0; k < simd_block_lanes; k++) {
+				d[k] = apply_op<float>(ins.op, a[k], b[k], c[k]);
+			}
+		};
+		// The close tier redoes the lanes whose arguments are too large to reduce accurately. They are
+		// set aside before the vector result is stored, since that may overwrite the argument register.
+		auto find_large_arguments = [&] {
+			size_t count = 0;
+			if (fast)
+				return count;
+			for (size_t k = 0; k < simd_block_lanes; k++) {
+				if (std::abs(a[k]) > trig_reduction_limit) {
+					large_lanes[count] = k;
+					large_arguments[count++] = a[k];
+				}
+			}
+			return count;
+		};
+		auto fix_large_arguments = [&](size_t count) {
+			for (size_t i = 0; i < count; i++)
+				d[large_lanes[i]] = apply_op<float>(ins.op, large_arguments[i], 0.0f, 0.0f);
+		};
+
+		switch (ins.op) {
+		case Op::Neg: PLANAR_SIMD_MAP(V::neg(A));
+		case Op::Add: PLANAR_SIMD_MAP(V::add(A, B));
+		case Op::Sub: PLANAR_SIMD_MAP(V::sub(A, B));
+		case Op::Mul: PLANAR_SIMD_MAP(V::mul(A, B));
+		case Op::Div: PLANAR_SIMD_MAP(V::div(A, B));
+		case Op::Lt: PLANAR_SIMD_MAP(V::lt(A, B, one));
+		case Op::Le: PLANAR_SIMD_MAP(V::le(A, B, one));
+		case Op::Gt: PLANAR_SIMD_MAP(V::lt(B, A, one));
+		case Op::Ge: PLANAR_SIMD_MAP(V::le(B, A, one));
+		case Op::Eq: PLANAR_SIMD_MAP(V::le(V::abs(V::sub(A, B)), V::mul(V::max(one, V::max(V::abs(A), V::abs(B))), epsilon), one));
+		case Op::Ne: PLANAR_SIMD_MAP(V::lt(V::mul(V::max(one, V::max(V::abs(A), V::abs(B))), epsilon), V::abs(V::sub(A, B)), one));
+		case Op::And: PLANAR_SIMD_MAP(V::mul(V::truth(A, zero, one), V::truth(B, zero, one)));
+		case Op::Or: PLANAR_SIMD_MAP(V::max(V::truth(A, zero, one), V::truth(B, zero, one)));
+		case Op::Not: PLANAR_SIMD_MAP(V::sub(one, V::truth(A, zero, one)));
+		case Op::Select: PLANAR_SIMD_MAP(V::select(A, B, C, zero));
+		case Op::Min: PLANAR_SIMD_MAP(V::min(A, B));
+		case Op::Max: PLANAR_SIMD_MAP(V::max(A, B));
+		case Op::Hypot: PLANAR_SIMD_MAP(V::sqrt(V::add(V::mul(A, A), V::mul(B, B))));
+		case Op::Abs: PLANAR_SIMD_MAP(V::abs(A));
+		case Op::Sqrt: PLANAR_SIMD_MAP(V::sqrt(A));
+		case Op::Floor: PLANAR_SIMD_MAP(V::floor(A));
+		case Op::Ceil: PLANAR_SIMD_MAP(V::ceil(A));
+		case Op::Trunc: PLANAR_SIMD_MAP(V::trunc(A));
+		case Op::Round: PLANAR_SIMD_MAP(V::select(V::lt(A, zero, one), V::ceil(V::sub(A, half)), V::floor(V::add(A, half)), zero));
+		case Op::Sgn: PLANAR_SIMD_MAP(V::sub(V::lt(zero, A, one), V::lt(A, zero, one)));
+		case Op::MulAdd: PLANAR_SIMD_MAP(V::muladd(A, B, C));
+		case Op::Square: PLANAR_SIMD_MAP(V::mul(A, A));
+		case Op::SumSquares: PLANAR_SIMD_MAP(V::muladd(A, A, V::mul(B, B)));
+		case Op::Sin:
+			if (!vector_math) { apply_scalar(); break; }
+			{
+				const size_t large = find_large_arguments();
+				for (size_t k = 0; k < simd_block_lanes; k += V::width) V::store(d + k, vector_sin(A, fast));
+				fix_large_arguments(large);
+			}
+			break;
+		case Op::Cos:
+			if (!vector_math) { apply_scalar(); break; }
+			{
+				const size_t large = find_large_arguments();
+				for (size_t k = 0; k < simd_block_lanes; k += V::width) V::store(d + k, vector_cos(A, fast));
+				fix_large_arguments(large);
+			}
+			break;
+		case Op::Exp:
+			if (!vector_math) { apply_scalar(); break; }
+			PLANAR_SIMD_MAP(vector_exp(A, fast));
+		case Op::Log:
+			if (!vector_math) { apply_scalar(); break; }
+			PLANAR_SIMD_MAP(vector_log(A, fast));
+		case Op::Pow:
+			// exp(b log a) cannot hold one ulp in single precision, so only the approximate tier vectorises pow
+			if (!fast) { apply_scalar(); break; }
+			PLANAR_SIMD_MAP(vector_pow(A, B));
+		default:
+			apply_scalar();
+			break;
+		}
+	}
+}
+
+#undef PLANAR_SIMD_MAP
+#undef A
+#undef B
+#undef C
+
+// Runs the program over count lanes, one block at a time. emit(registers, start, lanes) copies what
+// it needs out of each finished block.
+template <typename Emit>
+inline void run_blocks(const Program& program, const float* const* inputs, size_t count, MathAccuracy accuracy, Emit emit) {
+	thread_local std::vector<float> scratch;
+	if (scratch.size() < program.register_count * simd_block_lanes)
+		scratch.resize(program.register_count * simd_block_lanes);
+	float* registers = scratch.data();
+
+	for (size_t i = 0; i < program.constants.size(); i++) {
+		float* reg = registers + (program.first_constant() + i) * simd_block_lanes;
+		std::fill(reg, reg + simd_block_lanes, static_cast<float>(program.constants[i]));
+	}
+
+	for (size_t start = 0; start < count; start += simd_block_lanes) {
+		const size_t lanes = std::min(simd_block_lanes, count - start);
+
+		for (size_t i = 0; i < program.inputs.size(); i++) {
+			float* reg = registers + i * simd_block_lanes;
+			std::copy(inputs[i] + start, inputs[i] + start + lanes, reg);
+			std::fill(reg + lanes, reg + simd_block_lanes, 0.0f);
+		}
+
+		run_block(program, registers, accuracy);
+		emit(registers, start, lanes);
+	}
+}
+
+inline void evaluate(const Program& program, const float* const* inputs, float* out, size_t count, MathAccuracy accuracy) {
+	run_blocks(program, inputs, count, accuracy, [&](const float* registers, size_t start, size_t lanes) {
+		const float* result = registers + program.result * simd_block_lanes;
+		std::copy(result, result + lanes, out + start);
+	});
+}
+
+// Writes every result of the program: outs[i] receives program.results[i].
+inline void evaluate_outputs(const Program& program, const float* const* inputs, float* const* outs, size_t count, MathAccuracy accuracy) {
+	run_blocks(program, inputs, count, accuracy, [&](const float* registers, size_t start, size_t lanes) {
+		for (size_t i = 0; i < program.results.size(); i++) {
+			const float* result = registers + program.results[i] * simd_block_lanes;
+			std::copy(result, result + lanes, outs[i] + start);
+		}
+	});
+}
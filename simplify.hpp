@@ -0,0 +1,212 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "expression_tree.hpp"
+#include "program.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <tuple>
+#include <vector>
+
+// Rebuilds an ExprTree with constants folded, integer and half powers turned into multiplications
+// and square roots, trivial identities removed, and identical subtrees merged into one node. The
+// result is a DAG; lower_program() then evaluates every shared node once per sample.
+class ExpressionSimplifier {
+public:
+	ExprTree simplify(const ExprTree& tree) {
+		std::vector<int> roots = { tree.root };
+		return simplify(tree, roots);
+	}
+
+	// Simplifies several roots of one tree together, so subtrees they have in common become one
+	// node. roots is updated to point into the returned tree, whose root is the first of them.
+	ExprTree simplify(const ExprTree& tree, std::vector<int>& roots) {
+		source = &tree;
+		out = ExprTree();
+		out.variables = tree.variables;
+		interned.clear();
+		rebuilt.assign(tree.nodes.size(), -1);
+
+		for (int& root : roots)
+			root = rebuild(root);
+		out.root = roots.empty() ? -1 : roots[0];
+		return out;
+	}
+
+private:
+	typedef std::tuple<int, int, int, int, uint64_t, int> Key;
+
+	const ExprTree* source = nullptr;
+	ExprTree out;
+	std::map<Key, int> interned;
+	std::vector<int> rebuilt;
+
+	static bool commutative(Op op) {
+		switch (op) {
+		case Op::Add:
+		case Op::Mul:
+		case Op::Eq:
+		case Op::Ne:
+		case Op::And:
+		case Op::Or:
+		case Op::Hypot:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	bool is_constant(int node) const {
+		return out.nodes[node].op == Op::Const;
+	}
+
+	bool is_constant(int node, double value) const {
+		return is_constant(node) && out.nodes[node].value == value;
+	}
+
+	int intern(ExprNode node) {
+		if (commutative(node.op) && node.args[0] > node.args[1])
+			std::swap(node.args[0], node.args[1]);
+
+		uint64_t bits;
+		std::memcpy(&bits, &node.value, sizeof(bits));
+		const Key key(static_cast<int>(node.op), node.args[0], node.args[1], node.args[2], bits, node.variable);
+
+		auto it = interned.find(key);
+		if (it != interned.end())
+			return it->second;
+
+		const int id = out.add(node);
+		interned.emplace(key, id);
+		return id;
+	}
+
+	int constant(double value) {
+		ExprNode node;
+		node.op = Op::Const;
+		node.value = value;
+		return intern(node);
+	}
+
+	int make(Op op, int a = -1, int b = -1, int c = -1) {
+		ExprNode node;
+		node.op = op;
+		node.args[0] = a;
+		node.args[1] = b;
+		node.args[2] = c;
+
+		const int arity = op_arity(op);
+		bool folded = arity > 0;
+		for (int i = 0; i < arity; i++)
+			folded = folded && is_constant(node.args[i]);
+		if (folded) {
+			const double va = out.nodes[a].value;
+			const double vb = arity > 1 ? out.nodes[b].value : 0.0;
+			const double vc = arity > 2 ? out.nodes[c].value : 0.0;
+			return constant(apply_op<double>(op, va, vb, vc));
+		}
+
+		switch (op) {
+		case Op::Add:
+			if (is_constant(a, 0.0)) return b;
+			if (is_constant(b, 0.0)) return a;
+			break;
+		case Op::Sub:
+			if (is_constant(b, 0.0)) return a;
+			if (is_constant(a, 0.0)) return make(Op::Neg, b);
+			break;
+		case Op::Mul:
+			if (is_constant(a, 1.0)) return b;
+			if (is_constant(b, 1.0)) return a;
+			if (is_constant(a, -1.0)) return make(Op::Neg, b);
+			if (is_constant(b, -1.0)) return make(Op::Neg, a);
+			break;
+		case Op::Div:
+			if (is_constant(b, 1.0)) return a;
+			break;
+		case Op::Neg:
+			if (out.nodes[a].op == Op::Neg) return out.nodes[a].args[0];
+			break;
+		case Op::Pow:
+			if (is_constant(b))
+				return power(a, out.nodes[b].value, b);
+			break;
+		case Op::Select:
+			if (is_constant(a)) return out.nodes[a].value != 0.0 ? b : c;
+			if (b == c) return b;
+			break;
+		default:
+			break;
+		}
+
+		return intern(node);
+	}
+
+	int power(int base, double exponent, int exponent_node) {
+		if (exponent == 0.0)
+			return constant(1.0);
+		if (exponent == 1.0)
+			return base;
+		if (exponent == 0.5)
+			return make(Op::Sqrt, base);
+
+		const double magnitude = std::abs(exponent);
+		if (magnitude == std::floor(magnitude) && magnitude <= 16.0) {
+			int n = static_cast<int>(magnitude);
+			int result = -1;
+			int square = base;
+			while (n > 0) {
+				if (n & 1)
+					result = result < 0 ? square : make(Op::Mul, result, square);
+				n >>= 1;
+				if (n > 0)
+					square = make(Op::Mul, square, square);
+			}
+			return exponent < 0.0 ? make(Op::Div, constant(1.0), result) : result;
+		}
+
+		ExprNode node;
+		node.op = Op::Pow;
+		node.args[0] = base;
+		node.args[1] = exponent_node;
+		return intern(node);
+	}
+
+	int rebuild(int node) {
+		if (rebuilt[node] >= 0)
+			return rebuilt[node];
+
+		const ExprNode& n = source->nodes[node];
+		int result;
+		if (n.op == Op::Const) {
+			result = constant(n.value);
+		}
+		else if (n.op == Op::Var) {
+			ExprNode variable;
+			variable.op = Op::Var;
+			variable.variable = n.variable;
+			result = intern(variable);
+		}
+		else {
+			int args[3] = { -1, -1, -1 };
+			for (int i = 0; i < op_arity(n.op); i++)
+				args[i] = rebuild(n.args[i]);
+			result = make(n.op, args[0], args[1], args[2]);
+		}
+
+		rebuilt[node] = result;
+		return result;
+	}
+};
+
+// Operations per sample once shared subtrees are computed only once.
+inline size_t count_operations(const ExprTree& tree) {
+	Program program;
+	if (!lower_program(tree, program))
+		return 0;
+	return program.code.size();
+}
+
+#endif // !SIMPLIFY_H
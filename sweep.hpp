@@ -0,0 +1,88 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// A parameter of an equation swept over a range, with every frame precomputed in the background.
+// Frames keep only the heights of the equation's samples, one float each, so that they can live in
+// a single GPU buffer and a frame is picked by moving the attribute offset into it.
+struct ParameterSweep {
+	size_t frame_count = 0;
+	size_t sample_count = 0;
+	// position with a zero height and colour of every sample; released once uploaded
+	std::vector<float> base;
+	// frame after frame, laid out like the height grid; released once uploaded
+	std::vector<float> heights;
+	std::atomic<size_t> completed{ 0 };
+
+	// owned by the render thread: the vertex array, the x and y positions with the colour of every
+	// sample, and the heights of every frame
+	unsigned int vertex_array = 0;
+	unsigned int base_buffer = 0;
+	unsigned int height_buffer = 0;
+	bool uploaded = false;
+	int frame = 0;
+
+	ParameterSweep() = default;
+	ParameterSweep(const ParameterSweep&) = delete;
+	ParameterSweep& operator=(const ParameterSweep&) = delete;
+
+	~ParameterSweep() {
+		cancel();
+	}
+
+	static size_t bytes(size_t frames, size_t samples) {
+		return frames * samples * sizeof(float);
+	}
+
+	// Fills frame after frame on worker threads until every frame is done or the sweep is cancelled.
+	// compute(frame, out) writes the sample_count heights of one frame.
+	void start(size_t frames, size_t samples, std::function<void(size_t, float*)> compute) {
+		cancel();
+		frame_count = frames;
+		sample_count = samples;
+		heights.assign(frames * samples, 0.0f);
+		completed = 0;
+		next_frame = 0;
+		cancelled = false;
+
+		// one thread is left to the render loop
+		const size_t thread_count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+		for (size_t i = 0; i < std::min(thread_count, frames); i++) {
+			workers.emplace_back([this, compute] {
+				for (size_t f = next_frame++; f < frame_count && !cancelled; f = next_frame++) {
+					compute(f, heights.data() + f * sample_count);
+					completed++;
+				}
+			});
+		}
+	}
+
+	bool finished() const {
+		return frame_count > 0 && completed == frame_count;
+	}
+
+	// Waits for the workers, which have nothing left to do once finished() holds.
+	void join() {
+		for (auto& worker : workers)
+			worker.join();
+		workers.clear();
+	}
+
+	void cancel() {
+		cancelled = true;
+		join();
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::atomic<size_t> next_frame{ 0 };
+	std::atomic<bool> cancelled{ false };
+};
+
+#endif // !SWEEP_H
@@ -0,0 +1,121 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel loops. The calling thread takes part as worker 0,
+// so a pool created with one thread runs everything inline.
+class ThreadPool {
+public:
+	explicit ThreadPool(size_t thread_count = std::max(1u, std::thread::hardware_concurrency())) {
+		for (size_t i = 1; i < thread_count; i++) {
+			workers.emplace_back([this, i] { worker_loop(i); });
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& worker : workers) {
+			worker.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t size() const {
+		return workers.size() + 1;
+	}
+
+	// Runs func(task, worker) for every task in [0, count) and returns once all of them have finished.
+	// worker is in [0, size()) and is never shared by two tasks running at the same time.
+	void parallel_for(size_t count, const std::function<void(size_t, size_t)>& func) {
+		if (count == 0)
+			return;
+
+		std::lock_guard<std::mutex> dispatch_lock(dispatch_mutex);
+
+		if (workers.empty() || count == 1) {
+			for (size_t i = 0; i < count; i++) {
+				func(i, 0);
+			}
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = &func;
+			job_count = count;
+			next_task = 0;
+			finished_tasks = 0;
+			active_workers = workers.size();
+			generation++;
+		}
+		wake.notify_all();
+
+		run_tasks(0);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return finished_tasks == job_count && active_workers == 0; });
+		job = nullptr;
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::mutex dispatch_mutex;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	const std::function<void(size_t, size_t)>* job = nullptr;
+	size_t job_count = 0;
+	std::atomic<size_t> next_task{ 0 };
+	size_t finished_tasks = 0;
+	size_t active_workers = 0;
+	size_t generation = 0;
+	bool stopping = false;
+
+	void run_tasks(size_t worker) {
+		size_t completed = 0;
+		for (size_t task = next_task++; task < job_count; task = next_task++) {
+			(*job)(task, worker);
+			completed++;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		finished_tasks += completed;
+		if (finished_tasks == job_count)
+			done.notify_all();
+	}
+
+	void worker_loop(size_t worker) {
+		size_t seen_generation = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return stopping || generation != seen_generation; });
+				if (stopping)
+					return;
+				seen_generation = generation;
+			}
+
+			run_tasks(worker);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			active_workers--;
+			if (active_workers == 0)
+				done.notify_all();
+		}
+	}
+};
+
+#endif // !THREAD_POOL_H
@@ -0,0 +1,157 @@
+// Vector sin, cos, exp, log and pow for one instruction set. simd_eval.hpp includes this file in
+// each instruction set's namespace, ahead of simd_kernels.inl. The close tier uses Cephes' single
+// precision polynomials and handles subnormal results and arguments; the approximate tier uses shorter
+// minimax fits and flushes those to zero.
+
+// Reduces x to r in [-pi/4, pi/4] with x = r + quadrant * pi/2. pi/2 is split in three parts so that
+// the reduction stays exact for moderate quadrants.
+inline V::reg reduce_quadrant(V::reg x, V::reg& quadrant) {
+	quadrant = V::floor(V::muladd(x, V::set1(0.636619772367581343f), V::set1(0.5f)));
+	V::reg r = V::muladd(quadrant, V::set1(-1.5703125f), x);
+	r = V::muladd(quadrant, V::set1(-4.837512969970703125e-4f), r);
+	return V::muladd(quadrant, V::set1(-7.54978995489188216e-8f), r);
+}
+
+// sin(r + quadrant * pi/2) for r in [-pi/4, pi/4].
+inline V::reg sin_quadrant(V::reg r, V::reg quadrant, bool fast) {
+	const V::reg one = V::set1(1.0f);
+	const V::reg zero = V::set1(0.0f);
+	const V::reg z = V::mul(r, r);
+
+	V::reg s = V::set1(-1.9515295891e-4f);
+	s = V::muladd(s, z, V::set1(8.3321608736e-3f));
+	s = V::muladd(s, z, V::set1(-1.6666654611e-1f));
+	s = V::muladd(V::mul(s, z), r, r);
+
+	V::reg c;
+	if (fast) {
+		c = V::set1(-1.3648714342e-3f);
+		c = V::muladd(c, z, V::set1(4.1661071306e-2f));
+	}
+	else {
+		c = V::set1(2.443315711809948e-5f);
+		c = V::muladd(c, z, V::set1(-1.388731625493765e-3f));
+		c = V::muladd(c, z, V::set1(4.166664568298827e-2f));
+	}
+	c = V::muladd(V::mul(c, z), z, V::muladd(z, V::set1(-0.5f), one));
+
+	const V::reg q = V::sub(quadrant, V::mul(V::set1(4.0f), V::floor(V::mul(quadrant, V::set1(0.25f)))));
+	const V::reg odd = V::sub(q, V::mul(V::set1(2.0f), V::floor(V::mul(q, V::set1(0.5f)))));
+	const V::reg value = V::select(odd, c, s, zero);
+	return V::select(V::lt(V::set1(1.5f), q, one), V::neg(value), value, zero);
+}
+
+inline V::reg vector_sin(V::reg x, bool fast) {
+	V::reg quadrant;
+	const V::reg r = reduce_quadrant(x, quadrant);
+	return sin_quadrant(r, quadrant, fast);
+}
+
+inline V::reg vector_cos(V::reg x, bool fast) {
+	V::reg quadrant;
+	const V::reg r = reduce_quadrant(x, quadrant);
+	return sin_quadrant(r, V::add(quadrant, V::set1(1.0f)), fast);
+}
+
+inline V::reg vector_exp(V::reg x, bool fast) {
+	const V::reg one = V::set1(1.0f);
+	const V::reg zero = V::set1(0.0f);
+	// above hi the result overflows; below lo it underflows, past the subnormals for the close tier
+	const V::reg hi = V::set1(88.7228391f);
+	const V::reg lo = V::set1(fast ? -87.3365479f : -103.972084f);
+	const V::reg clamped = V::min(V::max(x, lo), hi);
+
+	const V::reg n = V::floor(V::muladd(clamped, V::set1(1.44269504088896341f), V::set1(0.5f)));
+	V::reg r = V::muladd(n, V::set1(-0.693359375f), clamped);
+	r = V::muladd(n, V::set1(2.12194440e-4f), r);
+
+	V::reg p;
+	if (fast) {
+		p = V::set1(8.312525e-3f);
+		p = V::muladd(p, r, V::set1(4.1890113e-2f));
+		p = V::muladd(p, r, V::set1(1.66671145e-1f));
+		p = V::muladd(p, r, V::set1(4.99992318e-1f));
+	}
+	else {
+		p = V::set1(1.9875691500e-4f);
+		p = V::muladd(p, r, V::set1(1.3981999507e-3f));
+		p = V::muladd(p, r, V::set1(8.3334519073e-3f));
+		p = V::muladd(p, r, V::set1(4.1665795894e-2f));
+		p = V::muladd(p, r, V::set1(1.6666665459e-1f));
+		p = V::muladd(p, r, V::set1(5.0000001201e-1f));
+	}
+	const V::reg value = V::muladd(V::mul(p, r), r, V::add(r, one));
+
+	// n runs from -150 to 128, past what one power of two holds, so the scale is applied in halves
+	const V::reg half_n = V::floor(V::mul(n, V::set1(0.5f)));
+	V::reg result = V::mul(V::mul(value, V::pow2i(half_n)), V::pow2i(V::sub(n, half_n)));
+	result = V::select(V::lt(hi, x, one), V::set1(INFINITY), result, zero);
+	return V::select(V::lt(x, lo, one), zero, result, zero);
+}
+
+inline V::reg vector_log(V::reg x, bool fast) {
+	const V::reg one = V::set1(1.0f);
+	const V::reg zero = V::set1(0.0f);
+
+	V::reg scaled = x;
+	V::reg exponent_bias = zero;
+	if (!fast) {
+		const V::reg subnormal = V::lt(x, V::set1(1.17549435e-38f), one);
+		scaled = V::select(subnormal, V::mul(x, V::set1(33554432.0f)), x, zero);
+		exponent_bias = V::mul(subnormal, V::set1(-25.0f));
+	}
+
+	// m in [sqrt(1/2), sqrt(2)) and x = m * 2^e, with m - 1 as the polynomial argument
+	V::reg e;
+	V::reg m = V::frexp(scaled, e);
+	const V::reg low = V::lt(m, V::set1(0.707106781186547524f), one);
+	e = V::sub(V::add(e, exponent_bias), low);
+	m = V::sub(V::muladd(m, low, m), one);
+	const V::reg z = V::mul(m, m);
+
+	V::reg p;
+	if (fast) {
+		p = V::set1(-1.019172908e-1f);
+		p = V::muladd(p, m, V::set1(1.602438062e-1f));
+		p = V::muladd(p, m, V::set1(-1.713712723e-1f));
+		p = V::muladd(p, m, V::set1(1.992450349e-1f));
+		p = V::muladd(p, m, V::set1(-2.498326695e-1f));
+		p = V::muladd(p, m, V::set1(3.333424571e-1f));
+	}
+	else {
+		p = V::set1(7.0376836292e-2f);
+		p = V::muladd(p, m, V::set1(-1.1514610310e-1f));
+		p = V::muladd(p, m, V::set1(1.1676998740e-1f));
+		p = V::muladd(p, m, V::set1(-1.2420140846e-1f));
+		p = V::muladd(p, m, V::set1(1.4249322787e-1f));
+		p = V::muladd(p, m, V::set1(-1.6668057665e-1f));
+		p = V::muladd(p, m, V::set1(2.0000714765e-1f));
+		p = V::muladd(p, m, V::set1(-2.4999993993e-1f));
+		p = V::muladd(p, m, V::set1(3.3333331174e-1f));
+	}
+	V::reg y = V::mul(V::mul(p, m), z);
+	y = V::muladd(e, V::set1(-2.12194440e-4f), y);
+	y = V::muladd(z, V::set1(-0.5f), y);
+	V::reg result = V::muladd(e, V::set1(0.693359375f), V::add(m, y));
+
+	// log(0) is -inf, negative arguments have no logarithm, and inf and NaN pass through
+	result = V::select(V::le(x, zero, one), V::select(V::lt(x, zero, one), V::set1(NAN), V::set1(-INFINITY), zero), result, zero);
+	result = V::select(V::lt(V::set1(3.40282347e+38f), x, one), x, result, zero);
+	return V::select(V::le(x, x, one), result, x, zero);
+}
+
+// a^b as exp(b log|a|) in the approximate tier. Negative bases only have a power for integer exponents.
+inline V::reg vector_pow(V::reg a, V::reg b) {
+	const V::reg one = V::set1(1.0f);
+	const V::reg zero = V::set1(0.0f);
+
+	const V::reg magnitude = vector_exp(V::mul(b, vector_log(V::abs(a), true)), true);
+	const V::reg integral = V::le(V::sub(b, V::floor(b)), zero, one);
+	const V::reg odd = V::mul(integral, V::truth(V::sub(b, V::mul(V::set1(2.0f), V::floor(V::mul(b, V::set1(0.5f))))), zero, one));
+	const V::reg signed_power = V::select(integral, V::select(odd, V::neg(magnitude), magnitude, zero), V::set1(NAN), zero);
+
+	V::reg result = V::select(V::lt(a, zero, one), signed_power, magnitude, zero);
+	// like std::pow, x^0 and 1^y are 1 even when the other operand is NaN
+	result = V::select(V::le(V::abs(b), zero, one), one, result, zero);
+	return V::select(V::le(V::abs(V::sub(a, one)), zero, one), one, result, zero);
+}
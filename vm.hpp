@@ -0,0 +1,37 @@
+#ifndef VM_H
+#define VM_H
+
+#include "program.hpp"
+
+#include <vector>
+
+// Runs a compiled Program one sample at a time. registers must hold register_count values with the
+// constants already in place (see load_constants) and the inputs written to the first registers.
+template <typename T>
+inline T run_program(const Program& program, T* registers) {
+	T* r = registers;
+	for (const Instruction& ins : program.code) {
+		switch (ins.op) {
+		case Op::Neg: r[ins.dst] = -r[ins.a]; break;
+		case Op::Add: r[ins.dst] = r[ins.a] + r[ins.b]; break;
+		case Op::Sub: r[ins.dst] = r[ins.a] - r[ins.b]; break;
+		case Op::Mul: r[ins.dst] = r[ins.a] * r[ins.b]; break;
+		case Op::Div: r[ins.dst] = r[ins.a] / r[ins.b]; break;
+		case Op::MulAdd: r[ins.dst] = r[ins.a] * r[ins.b] + r[ins.c]; break;
+		case Op::Square: r[ins.dst] = r[ins.a] * r[ins.a]; break;
+		case Op::SumSquares: r[ins.dst] = r[ins.a] * r[ins.a] + r[ins.b] * r[ins.b]; break;
+		default: r[ins.dst] = apply_op<T>(ins.op, r[ins.a], r[ins.b], r[ins.c]); break;
+		}
+	}
+	return r[program.result];
+}
+
+template <typename T>
+inline void load_constants(const Program& program, std::vector<T>& registers) {
+	registers.assign(program.register_count, T(0));
+	for (size_t i = 0; i < program.constants.size(); i++) {
+		registers[program.first_constant() + i] = static_cast<T>(program.constants[i]);
+	}
+}
+
+#endif // !VM_H